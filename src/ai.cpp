@@ -1,253 +1,1029 @@
 #include "ai.hpp"
+#include "eval.hpp"
+#include "move_picker.hpp"
+#include "stats.hpp"
+#include "syzygy.hpp"
+#include "thread_pool.hpp"
+#include <atomic>
+#include <chrono>
+#include <algorithm>
 #include <limits.h>
-#include <list>
-#include <map>
+#include <math.h>
+#include <memory>
+#include <mutex>
 #include <stdio.h>
 #include <stdlib.h>
+#include <thread>
+#include <vector>
 
 using namespace chess;
 using namespace ai;
 
 // a combination move and rating
 struct _RatedMove {
-  Move &move;
+  Move move;
   int rating;
-
-  static bool best_move(const _RatedMove &lhs, const _RatedMove &rhs) {
-    return lhs.rating > rhs.rating;
-  }
 };
 
-// create a hashed version of the board for set lookup
-struct _HashBoard {
-  unsigned squares[BOARD_SIZE * BOARD_SIZE / 2];
-
-  _HashBoard(Game &game) {
-    for (uint8_t y = 0; y < BOARD_SIZE; y++) {
-      for (uint8_t x = 0; x < BOARD_SIZE; x++) {
-        Piece *piece = game.board[y][x];
-        unsigned value = 0;
-        if (piece) {
-          value = piece->type | (piece->color == BLACK ? 0b1000 : 0);
-        }
-        if (x % 2 == 1) {
-          squares[(y * BOARD_SIZE + x) / 2] |= value << 4;
-        } else {
-          squares[(y * BOARD_SIZE + x) / 2] = value;
-        }
+// the legal moves of a position with their ratings, kept on the stack
+struct _RatedMoveList {
+  _RatedMove moves[MAX_MOVES];
+  unsigned size = 0;
+  _RatedMove *begin() { return moves; }
+  _RatedMove *end() { return moves + size; }
+  _RatedMove &front() { return moves[0]; }
+  bool empty() const { return !size; }
+
+  // sort the moves best first, keeping the order of equally rated moves
+  void sort() {
+    for (unsigned i = 1; i < size; i++) {
+      _RatedMove rated_move = moves[i];
+      unsigned j = i;
+      for (; j > 0 && moves[j - 1].rating < rated_move.rating; j--) {
+        moves[j] = moves[j - 1];
       }
+      moves[j] = rated_move;
     }
   }
+};
+
+TranspositionTable ai::trans_table(16);
+unsigned ai::num_threads = 1;
+SearchMode ai::search_mode = LAZY_SMP;
+bool ai::split_replies = false;
+bool ai::verbose = true;
+void (*ai::on_iteration)(const MoveChoice &choice) = nullptr;
+bool ai::null_move_pruning = true, ai::late_move_reductions = true,
+     ai::futility_pruning = true;
+unsigned ai::tb_probe_limit = 7;
+
+struct _Thread;
+
+// the state of one search, shared by its threads; several searches can run at
+// once, each on its own game
+struct _Search {
+  Limits limits;
+  TranspositionTable &table;
+  std::chrono::steady_clock::time_point start_time;
+  // milliseconds after the start that the movetime is counted from, which
+  // moves along with the search while it's pondering
+  std::atomic<unsigned> clock_start{0};
+  // counts of every thread, added as they finish
+  std::atomic<uint64_t> nodes{0}, qnodes{0}, tb_hits{0};
+  PruneCounts prunes = {};
+  SearchStats stats = {};
+  // the threads still searching, whose nodes aren't all in the total yet
+  std::vector<_Thread *> threads;
+  std::mutex counts_mutex;
+  // set once an iteration has finished, so there is a move to play if the
+  // search stops
+  std::atomic<bool> can_stop{false};
+  // set to make every thread of the search return as soon as possible
+  std::atomic<bool> stop{false};
+  // the pool root splitting hands moves to
+  std::shared_ptr<ThreadPool> pool;
+};
+
+// a search thread's view of the game, which no other thread touches
+struct _Thread {
+  Game &game;
+  _Search &search;
+  unsigned id;
+  // nodes searched since the thread last added them to the search's total,
+  // which other threads read when reporting
+  std::atomic<unsigned> nodes;
+  // nodes searched in the quiescence search, and positions found in the
+  // tablebases
+  uint64_t qnodes = 0, tb_hits = 0;
+  // set when another thread has cut off the node this thread is searching
+  const std::atomic<bool> *cutoff = nullptr;
+  // distance from the root of the search
+  unsigned ply = 0;
+  MoveHistory history = {};
+  PruneCounts prunes = {};
+  // triangular table of the best line found from each ply, each line
+  // starting at its own ply
+  Move pv[MAX_PLY][MAX_PLY];
+  unsigned pv_length[MAX_PLY];
+};
+
+// the pool root splitting hands moves to, kept between searches; each search
+// holds on to the pool it started with, so another search replacing it with
+// one of a different size can't destroy it while it's in use
+std::shared_ptr<ThreadPool> _pool;
+std::mutex _pool_mutex;
+
+// how often each thread adds its nodes to the total and checks the limits
+#define NODES_PER_CHECK 1024
+// initial half-width of the window around the last iteration's rating
+#define ASPIRATION_WINDOW 50
+// most a position's rating could rise besides the material a capture takes,
+// for pruning captures in the quiescence search that can't reach alpha
+#define DELTA_MARGIN 200
+// deepest remaining depth that futility pruning is tried at, and how far
+// outside the window the static rating must be per ply of depth
+#define FUTILITY_DEPTH 3
+#define FUTILITY_MARGIN 120
+// below this phase, passing the turn is likely to be better than any move, so
+// null-move cutoffs are verified
+#define ZUGZWANG_PHASE 6
+// number of moves searched at full depth before later ones are reduced
+#define FULL_DEPTH_MOVES 3
+// rating of a tablebase win, above any static rating and below a mate, less
+// the ply it was found at so nearer wins are preferred
+#define TB_WIN 100000
+// ratings at least this far from zero, mates and tablebase wins, count the
+// plies from the root
+#define MIN_MATE (MATE - MAX_PLY)
+#define MIN_TB_WIN (TB_WIN - MAX_PLY)
 
-  bool operator<(const _HashBoard &rhs) const {
-    uint64_t *lhs_squares = (uint64_t *)squares;
-    uint64_t *rhs_squares = (uint64_t *)rhs.squares;
-    for (uint8_t i = 0; i < BOARD_SIZE * BOARD_SIZE / 2 / sizeof(uint64_t);
-         i++) {
-      if (lhs_squares[i] < rhs_squares[i]) {
-        return true;
-      } else if (lhs_squares[i] > rhs_squares[i]) {
-        return false;
+// how much to reduce a late move by remaining depth and move number, growing
+// with the log of each
+uint8_t _reductions[64][MAX_MOVES];
+static struct _ReductionTable {
+  _ReductionTable() {
+    for (unsigned depth = 1; depth < 64; depth++) {
+      for (unsigned moves = 1; moves < MAX_MOVES; moves++) {
+        _reductions[depth][moves] = 0.75 + log(depth) * log(moves) / 2.25;
       }
     }
-    return false;
   }
+} _reduction_table;
+
+// a rating counting plies from the root as one counting them from the
+// position at `ply`, so it holds wherever the position is reached again
+int _to_table(int rating, unsigned ply) {
+  return rating >= MIN_TB_WIN    ? rating + (int)ply
+         : rating <= -MIN_TB_WIN ? rating - (int)ply
+                                 : rating;
+}
 
-  bool operator==(const _HashBoard &rhs) {
-    uint64_t *lhs_squares = (uint64_t *)squares;
-    uint64_t *rhs_squares = (uint64_t *)rhs.squares;
-    return lhs_squares[0] == rhs_squares[0] &&
-           lhs_squares[1] == rhs_squares[1] &&
-           lhs_squares[2] == rhs_squares[2] && lhs_squares[3] == rhs_squares[3];
+// a rating from the table as one counting plies from the root again
+int _from_table(int rating, unsigned ply) {
+  return rating >= MIN_TB_WIN    ? rating - (int)ply
+         : rating <= -MIN_TB_WIN ? rating + (int)ply
+                                 : rating;
+}
+
+int ai::mate_moves(int rating) {
+  if (rating >= MIN_MATE) {
+    return (MATE - rating + 1) / 2;
   }
-};
+  if (rating <= -MIN_MATE) {
+    return -(MATE + rating) / 2;
+  }
+  return 0;
+}
 
-struct _Entry {
-  int rating;
-  unsigned depth;
-  enum Flag { EXACT, LOWERBOUND, UPPERBOUND } flag;
-};
+// milliseconds since the search started
+unsigned _elapsed(_Search &search) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now() - search.start_time)
+      .count();
+}
 
-// get the score for a single player
-int _rate_player(Game &game, Player *player) {
-  int score = 0;
-  uint8_t x, y;
-  for (Piece &piece : player->pieces) {
-    if (piece.is_live) {
-      unsigned piece_multipliers[] = {0, 1, 3, 3, 5, 9, 0};
-      score += 100 * piece_multipliers[piece.type];
-      int square_bonus[] = {2, 2, 3, 6, 6, 3, 2, 2};
-      if (piece.type == Piece::PAWN) {
-        score += 3 * (square_bonus[piece.x] + square_bonus[piece.y]);
-      } else if (piece.type == Piece::KNIGHT) {
-        score += square_bonus[piece.x] + square_bonus[piece.y];
-        for (Delta delta : KNIGHT_DELTAS) {
-          x = piece.x + delta.x, y = piece.y + delta.y;
-          if (x < BOARD_SIZE && y < BOARD_SIZE) {
-            if (game.board[y][x] && game.board[y][x]->color != player->color) {
-              score += 10 * piece_multipliers[game.board[y][x]->type];
-            } else {
-              score += square_bonus[x] + square_bonus[y];
-            }
-          }
-        }
-      } else {
-        unsigned capture_multiplier = piece.type == Piece::QUEEN ? 4 : 8;
-        if (piece.type == Piece::BISHOP || piece.type == Piece::QUEEN) {
-          for (Delta delta : DIAGONAL_DELTAS) {
-            for (unsigned d = 1;; d++) {
-              x = piece.x + delta.x * d, y = piece.y + delta.y * d;
-              if (x >= BOARD_SIZE || y >= BOARD_SIZE) {
-                break;
-              }
-              score += square_bonus[x] + square_bonus[y];
-              if (game.board[y][x]) {
-                if (game.board[y][x]->color != player->color) {
-                  score += capture_multiplier *
-                           piece_multipliers[game.board[y][x]->type];
-                }
-                break;
-              }
-            }
-          }
-        }
-        if (piece.type == Piece::ROOK || piece.type == Piece::QUEEN) {
-          for (Delta delta : HORZ_VERT_DETLAS) {
-            for (unsigned d = 1;; d++) {
-              x = piece.x + delta.x * d, y = piece.y + delta.y * d;
-              if (x >= BOARD_SIZE || y >= BOARD_SIZE) {
-                break;
-              }
-              score += square_bonus[x] + square_bonus[y];
-              if (game.board[y][x]) {
-                if (game.board[y][x]->color != player->color) {
-                  score += capture_multiplier *
-                           piece_multipliers[game.board[y][x]->type];
-                }
-                break;
-              }
-            }
-          }
-        }
+// determines if the caller has asked the search to stop
+bool _stop_requested(_Search &search) {
+  return search.limits.stop && *search.limits.stop;
+}
+
+// determines if the search is pondering, in which case its nodes and time
+// don't count against its limits
+bool _pondering(_Search &search) {
+  return search.limits.ponder && *search.limits.ponder;
+}
+
+// milliseconds counted against the movetime
+unsigned _clock(_Search &search) {
+  return _elapsed(search) - search.clock_start;
+}
+
+// stop the search once it has used up its time or nodes, or been asked to
+void _check_limits(_Search &search) {
+  if (_pondering(search)) {
+    search.clock_start = _elapsed(search);
+  }
+  const Limits &limits = search.limits;
+  if (search.can_stop &&
+      (_stop_requested(search) ||
+       (!_pondering(search) &&
+        ((limits.nodes && search.nodes >= limits.nodes) ||
+         (limits.movetime && _clock(search) >= limits.movetime))))) {
+    search.stop = true;
+  }
+}
+
+// count a node, adding the thread's nodes to the total and checking the
+// limits every `NODES_PER_CHECK` nodes, or as soon as the nodes not added yet
+// reach a node limit so the search stops right on it
+void _count_node(_Thread &thread) {
+  _Search &search = thread.search;
+  unsigned nodes = thread.nodes.load(std::memory_order_relaxed) + 1;
+  if (nodes < NODES_PER_CHECK &&
+      (!search.limits.nodes ||
+       search.nodes.load(std::memory_order_relaxed) + nodes <
+           search.limits.nodes)) {
+    thread.nodes.store(nodes, std::memory_order_relaxed);
+    return;
+  }
+  thread.nodes.store(0, std::memory_order_relaxed);
+  search.nodes += nodes;
+  _check_limits(search);
+}
+
+// have the search count a thread's nodes before it adds them to the total
+void _join(_Thread &thread) {
+  std::lock_guard<std::mutex> lock(thread.search.counts_mutex);
+  thread.search.threads.push_back(&thread);
+}
+
+// nodes searched so far by every thread, including those not added yet
+uint64_t _nodes(_Search &search) {
+  std::lock_guard<std::mutex> lock(search.counts_mutex);
+  uint64_t nodes = search.nodes;
+  for (_Thread *thread : search.threads) {
+    nodes += thread->nodes.load(std::memory_order_relaxed);
+  }
+  return nodes;
+}
+
+void PruneCounts::add(const PruneCounts &other) {
+  null_move += other.null_move;
+  null_move_refuted += other.null_move_refuted;
+  reductions += other.reductions;
+  re_searches += other.re_searches;
+  reverse_futility += other.reverse_futility;
+  futility += other.futility;
+  cutoffs += other.cutoffs;
+  first_move_cutoffs += other.first_move_cutoffs;
+}
+
+// add the nodes and prunes a thread hasn't counted yet to the totals, once
+// it has finished searching
+void _add_counts(_Thread &thread) {
+  _Search &search = thread.search;
+  search.qnodes += thread.qnodes;
+  search.tb_hits += thread.tb_hits;
+  std::lock_guard<std::mutex> lock(search.counts_mutex);
+  search.nodes += thread.nodes.exchange(0);
+  search.threads.erase(
+      std::find(search.threads.begin(), search.threads.end(), &thread));
+  search.prunes.add(thread.prunes);
+  STATS(search.stats.add(thread_stats); thread_stats = {});
+}
+
+// the stats the search has counted so far, including those of the calling
+// thread that it hasn't added yet
+SearchStats _stats_so_far(_Search &search) {
+  std::lock_guard<std::mutex> lock(search.counts_mutex);
+  SearchStats stats = search.stats;
+  stats.add(thread_stats);
+  return stats;
+}
+
+// the prunes the search has counted so far, including those of `thread`
+// that it hasn't added yet
+PruneCounts _prunes_so_far(_Thread &thread) {
+  std::lock_guard<std::mutex> lock(thread.search.counts_mutex);
+  PruneCounts prunes = thread.search.prunes;
+  prunes.add(thread.prunes);
+  return prunes;
+}
+
+// determines if a thread should abandon its search, its result unused
+bool _stopped(_Thread &thread) {
+  return thread.search.stop.load(std::memory_order_relaxed) ||
+         (thread.cutoff && thread.cutoff->load(std::memory_order_relaxed));
+}
+
+// make a move and the rest of the best line from the next ply the best line
+// from the current ply
+void _update_pv(_Thread &thread, Move move) {
+  unsigned ply = thread.ply;
+  thread.pv[ply][ply] = move;
+  for (unsigned i = ply + 1; i < thread.pv_length[ply + 1]; i++) {
+    thread.pv[ply][i] = thread.pv[ply + 1][i];
+  }
+  thread.pv_length[ply] = std::max(thread.pv_length[ply + 1], ply + 1);
+}
+
+// copy a move followed by a thread's best line from the next ply
+void _copy_line(_Thread &thread, unsigned ply, Move move, Line &line) {
+  line.moves[0] = move;
+  line.length = 1;
+  for (unsigned i = ply; i < thread.pv_length[ply]; i++) {
+    line.moves[line.length++] = thread.pv[ply][i];
+  }
+}
+
+void ai::print_line(const Line &line) {
+  char text[6];
+  for (unsigned i = 0; i < line.length; i++) {
+    line.moves[i].to_text(text);
+    printf("%s%s", i ? " " : "", text);
+  }
+}
+
+// raise an atomic rating to at least a value
+void _raise(std::atomic<int> &rating, int value) {
+  int current = rating.load();
+  while (value > current && !rating.compare_exchange_weak(current, value)) {
+  }
+}
+
+// rate each legal move by the position it leads to, best first
+void _rate_moves(Game &game, Player *max, Player *min,
+                 _RatedMoveList &rated_moves) {
+  MoveList moves;
+  game.get_moves(max, moves);
+  for (Move move : moves) {
+    game.make_move(move);
+    rated_moves.moves[rated_moves.size++] = {
+        .move = move,
+        .rating = evaluate(game, max)};
+    game.undo_move(move);
+  }
+  rated_moves.sort();
+}
+
+// search only captures, and every move when in check, until the position is
+// quiet, letting the player stand on the static rating instead of capturing
+int _quiesce(_Thread &thread, Player *max, Player *min, int a, int b) {
+  Game &game = thread.game;
+  thread.pv_length[thread.ply] = thread.ply;
+  // once stopped, nodes return before they're counted
+  if (_stopped(thread)) {
+    return 0;
+  }
+  _count_node(thread);
+  thread.qnodes++;
+  STATS(thread_stats.ply_nodes[thread.ply]++);
+
+  bool in_check = game.is_check(max);
+  int stand_pat = evaluate(game, max);
+  if (thread.ply >= MAX_PLY - 1) {
+    return stand_pat;
+  }
+  int rating = -INT_MAX;
+  if (!in_check) {
+    if (stand_pat >= b) {
+      return stand_pat;
+    }
+    a = std::max(a, stand_pat);
+    rating = stand_pat;
+  }
+
+  Move none;
+  none.data = 0;
+  MovePicker picker(game, max, none, thread.history, thread.ply, !in_check);
+  Move move;
+  while (picker.next(move)) {
+    if (!in_check) {
+      // skip captures that can't raise alpha even if nothing recaptures,
+      // and those that lose material once everything has recaptured
+      if (stand_pat + capture_gain(game, move) + DELTA_MARGIN <= a ||
+          see(game, move) < 0) {
+        continue;
       }
     }
+    game.make_move(move);
+    thread.ply++;
+    int res = -_quiesce(thread, min, max, -b, -a);
+    thread.ply--;
+    game.undo_move(move);
+    rating = std::max(rating, res);
+    a = std::max(a, rating);
+    if (a >= b) {
+      break;
+    }
   }
-  return score;
+  // in check, every move was searched, so none means mate
+  if (in_check && rating == -INT_MAX) {
+    return -MATE + (int)thread.ply;
+  }
+  return rating;
 }
 
-int _negamax(Game &game, Player *max, Player *min, unsigned depth, int a, int b,
-             int8_t color, std::map<_HashBoard, _Entry> trans_table,
-             bool last_capture = false) {
+int _negamax(_Thread &thread, Player *max, Player *min, unsigned depth, int a,
+             int b, bool can_pass = true) {
+  // rate the position once it's quiet
+  if (depth == 0) {
+    return _quiesce(thread, max, min, a, b);
+  }
+  Game &game = thread.game;
+  thread.pv_length[thread.ply] = thread.ply;
   int a_orig = a;
+  // once stopped, nodes return before they're counted
+  if (_stopped(thread)) {
+    return 0;
+  }
+  _count_node(thread);
+  STATS(thread_stats.ply_nodes[thread.ply]++);
+  if (thread.ply >= MAX_PLY - 1) {
+    return evaluate(game, max);
+  }
 
-  // check if the state has already been reached
-  _HashBoard hash_board(game);
-  std::map<_HashBoard, _Entry>::iterator entry = trans_table.find(hash_board);
-  if (entry != trans_table.end() && entry->second.depth >= depth) {
-    switch (entry->second.flag) {
-    case _Entry::EXACT:
-      return entry->second.rating;
-    case _Entry::LOWERBOUND:
-      a = std::max(a, entry->second.rating);
+  // check if the state has already been reached, only taking its rating with
+  // a null window so the principal variation isn't cut short
+  bool pv = (long)b - a > 1;
+  uint64_t key = game.hash;
+  TTEntry entry;
+  bool found = thread.search.table.probe(key, entry);
+  STATS(thread_stats.tt_probes++; thread_stats.tt_hits += found);
+  if (found) {
+    entry.rating = _from_table(entry.rating, thread.ply);
+  }
+  if (found && entry.depth >= depth && !pv) {
+    switch (entry.flag) {
+    case TTEntry::EXACT:
+      return entry.rating;
+    case TTEntry::LOWERBOUND:
+      a = std::max(a, entry.rating);
       break;
-    case _Entry::UPPERBOUND:
-      b = std::min(b, entry->second.rating);
+    case TTEntry::UPPERBOUND:
+      b = std::min(b, entry.rating);
       break;
+    default:
+      break;
+    }
+    if (a >= b) {
+      return entry.rating;
     }
   }
 
-  // if the node is terminal
-  if ((depth <= 2 && !last_capture) || depth == 0) {
-    return (_rate_player(game, max) - _rate_player(game, min)) * color;
+  // an endgame in the tablebases is looked up rather than searched, once a
+  // capture or pawn move means the fifty-move rule can't change its result
+  syzygy::WDL wdl;
+  if (popcount(game.occupancy[BLACK] | game.occupancy[WHITE]) <=
+          tb_probe_limit &&
+      !game.halfmove_clock && syzygy::probe_wdl(game, wdl)) {
+    thread.tb_hits++;
+    int value = wdl == syzygy::WIN    ? TB_WIN - (int)thread.ply
+                : wdl == syzygy::LOSS ? -TB_WIN + (int)thread.ply
+                                      : (int)wdl;
+    TTEntry::Flag flag = wdl == syzygy::WIN    ? TTEntry::LOWERBOUND
+                         : wdl == syzygy::LOSS ? TTEntry::UPPERBOUND
+                                               : TTEntry::EXACT;
+    if (flag == TTEntry::EXACT ||
+        (flag == TTEntry::LOWERBOUND && value >= b) ||
+        (flag == TTEntry::UPPERBOUND && value <= a)) {
+      TTEntry tb_entry = {
+          .rating = _to_table(value, thread.ply),
+          .move = 0,
+          .depth = (uint8_t)std::min(depth + 6, MAX_PLY - 1u),
+          .flag = flag,
+      };
+      thread.search.table.store(key, tb_entry);
+      return value;
+    }
   }
 
-  std::vector<Move> moves = game.get_moves(max);
-  std::list<_RatedMove> rated_moves;
-  for (Move &move : moves) {
-    if (game.make_move(move)) {
-      rated_moves.push_back(
-          {.move = move,
-           .rating = _rate_player(game, max) - _rate_player(game, min)});
-      game.undo_move(move);
+  // selective search is only tried with a null window, away from the
+  // principal variation
+  bool in_check = game.is_check(max);
+  int static_eval = in_check ? -INT_MAX : evaluate(game, max);
+  bool near_leaves = futility_pruning && !pv && !in_check &&
+                     depth <= FUTILITY_DEPTH;
+
+  // a static rating this far above beta won't be brought back down by a
+  // shallow search
+  if (near_leaves && static_eval - FUTILITY_MARGIN * (int)depth >= b) {
+    thread.prunes.reverse_futility++;
+    return static_eval;
+  }
+
+  // if passing the turn still fails high, a real move almost certainly would
+  // too; it isn't tried with only pawns left, where any move could be worse
+  // than passing
+  Color color = max->color;
+  Bitboard pieces = game.occupancy[color] &
+                    ~(game.pieces(color, Piece::PAWN) |
+                      game.pieces(color, Piece::KING));
+  if (null_move_pruning && can_pass && !pv && !in_check && depth >= 3 &&
+      static_eval >= b && pieces) {
+    unsigned reduced = depth - 1 - std::min(3 + depth / 6, depth - 1);
+    game.make_null_move();
+    thread.ply++;
+    int res = -_negamax(thread, min, max, reduced, -b, -b + 1, false);
+    thread.ply--;
+    game.undo_null_move();
+    if (res >= b && !_stopped(thread)) {
+      // zugzwang is likely with few pieces left, so confirm the cutoff with a
+      // search that doesn't pass
+      if (game.phase <= ZUGZWANG_PHASE &&
+          _negamax(thread, max, min, reduced, b - 1, b, false) < b) {
+        thread.prunes.null_move_refuted++;
+      } else {
+        thread.prunes.null_move++;
+        return b;
+      }
     }
   }
-  rated_moves.sort(_RatedMove::best_move);
+
+  // try the best move from an earlier search first
+  Move tt_move;
+  tt_move.data = found ? entry.move : 0;
+  MovePicker picker(game, max, tt_move, thread.history, thread.ply);
+  // near the leaves, quiet moves can't raise a static rating this far below
+  // alpha
+  bool futile =
+      near_leaves && static_eval + FUTILITY_MARGIN * (int)depth <= a;
   int rating = -INT_MAX;
-  for (_RatedMove &rated_move : rated_moves) {
-    if (game.make_move(rated_move.move)) {
-      rating =
-          std::max(rating, -_negamax(game, min, max, depth - 1, -b, -a, -color,
-                                     trans_table, rated_move.move.captured));
-      a = std::max(a, rating);
-      game.undo_move(rated_move.move);
-      if (a >= b) {
-        break;
+  Move move, best;
+  best.data = 0;
+  unsigned num_moves = 0;
+  while (picker.next(move)) {
+    bool quiet = !game.is_capture(move) && !move.promotion_type();
+    game.make_move(move);
+    num_moves++;
+    bool gives_check = game.is_check(min);
+    if (futile && quiet && !gives_check && num_moves > 1) {
+      game.undo_move(move);
+      thread.prunes.futility++;
+      continue;
+    }
+    // search the first move with the full window and the rest with a null
+    // window, which only needs to show they're no better, searching again
+    // with the full window if one is; late quiet moves are also searched to
+    // a reduced depth first, and again at full depth if they beat alpha
+    unsigned reduction = 0;
+    if (late_move_reductions && quiet && !in_check && !gives_check &&
+        depth >= 3 && num_moves > FULL_DEPTH_MOVES) {
+      int r = _reductions[std::min(depth, 63u)][num_moves] - pv;
+      reduction = std::max(0, std::min(r, (int)depth - 2));
+    }
+    thread.ply++;
+    int res;
+    if (num_moves == 1) {
+      res = -_negamax(thread, min, max, depth - 1, -b, -a);
+    } else {
+      thread.prunes.reductions += reduction > 0;
+      res = -_negamax(thread, min, max, depth - 1 - reduction, -a - 1, -a);
+      if (res > a && reduction) {
+        thread.prunes.re_searches++;
+        res = -_negamax(thread, min, max, depth - 1, -a - 1, -a);
+      }
+      if (res > a && res < b) {
+        res = -_negamax(thread, min, max, depth - 1, -b, -a);
       }
     }
+    thread.ply--;
+    if (res > rating || !best.data) {
+      rating = res;
+      best = move;
+    }
+    if (res > a) {
+      _update_pv(thread, move);
+    }
+    a = std::max(a, rating);
+    game.undo_move(move);
+    if (a >= b) {
+      if (quiet) {
+        thread.history.update(color, move, thread.ply, depth);
+      }
+      thread.prunes.cutoffs++;
+      thread.prunes.first_move_cutoffs += num_moves == 1;
+      break;
+    }
+  }
+  // a stopped search has no result worth storing
+  if (_stopped(thread)) {
+    return 0;
   }
-  // check for draw
-  if (!rated_moves.size() && game.get_state(max) != chess::Game::LOSS) {
-    rating = 0;
+  // with no moves, the player is either mated or stalemated
+  if (!best.data) {
+    rating = in_check ? -MATE + (int)thread.ply : 0;
   }
 
-  _Entry new_entry = {
-      .rating = rating,
-      .depth = depth,
+  TTEntry new_entry = {
+      .rating = _to_table(rating, thread.ply),
+      .move = best.data,
+      .depth = (uint8_t)depth,
   };
   if (rating <= a_orig) {
-    new_entry.flag = _Entry::UPPERBOUND;
+    new_entry.flag = TTEntry::UPPERBOUND;
   } else if (rating >= b) {
-    new_entry.flag = _Entry::LOWERBOUND;
+    new_entry.flag = TTEntry::LOWERBOUND;
   } else {
-    new_entry.flag = _Entry::EXACT;
+    new_entry.flag = TTEntry::EXACT;
+  }
+  thread.search.table.store(key, new_entry);
+  return rating;
+}
+
+// rate each root move by searching its replies to a depth within a window,
+// the first with the full window and the rest with a null window unless they
+// beat alpha, setting `rating` and `line` to the best and sorting the moves
+// best first; returns false if the search was stopped before it finished
+bool _search_root(_Thread &thread, Player *max, Player *min, unsigned depth,
+                  int a, int b, _RatedMoveList &rated_moves, int &rating,
+                  Line &line) {
+  rating = -INT_MAX;
+  line.length = 0;
+  STATS(thread_stats.ply_nodes[0]++);
+  for (_RatedMove &rated_move : rated_moves) {
+    thread.game.make_move(rated_move.move);
+    thread.ply = 1;
+    int res;
+    if (rating == -INT_MAX) {
+      res = -_negamax(thread, min, max, depth - 1, -b, -a);
+    } else {
+      res = -_negamax(thread, min, max, depth - 1, -a - 1, -a);
+      if (res > a && res < b) {
+        res = -_negamax(thread, min, max, depth - 1, -b, -a);
+      }
+    }
+    thread.ply = 0;
+    thread.game.undo_move(rated_move.move);
+    if (thread.search.stop.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    rated_move.rating = res;
+    if (res > rating || !line.length) {
+      rating = res;
+      _copy_line(thread, 1, rated_move.move, line);
+    }
+    a = std::max(a, res);
+    if (a >= b) {
+      break;
+    }
+  }
+  rated_moves.sort();
+  return true;
+}
+
+// search the root of a copy of the game at staggered depths until stopped,
+// filling the shared table with results the main thread can reuse
+void _helper_search(_Thread &thread, Color color, unsigned max_depth) {
+  Player *max = color == BLACK ? &thread.game.black : &thread.game.white;
+  Player *min = color == BLACK ? &thread.game.white : &thread.game.black;
+  _RatedMoveList rated_moves;
+  _rate_moves(thread.game, max, min, rated_moves);
+  if (rated_moves.empty()) {
+    return;
+  }
+  _join(thread);
+  // start each helper on a different move so they don't all duplicate the
+  // main thread's work
+  std::rotate(rated_moves.begin(),
+              rated_moves.begin() + thread.id % rated_moves.size,
+              rated_moves.end());
+  int rating;
+  Line line;
+  for (unsigned depth = 2 + thread.id % 2; depth <= max_depth + 1; depth++) {
+    if (!_search_root(thread, max, min, depth, -INT_MAX, INT_MAX,
+                      rated_moves, rating, line)) {
+      break;
+    }
+  }
+  _add_counts(thread);
+}
+
+// rate one of a player's moves at a ply by searching a copy of the game,
+// setting `line` to the move and the best line after it
+int _search_copy(_Search &search, Game &original, Color color, Move move,
+                 unsigned ply, unsigned depth, int a, int b,
+                 const std::atomic<bool> *cutoff, Line &line) {
+  Game game = original;
+  Player *max = color == BLACK ? &game.black : &game.white;
+  Player *min = color == BLACK ? &game.white : &game.black;
+  game.make_move(move);
+  _Thread thread = {.game = game,
+                    .search = search,
+                    .id = 0,
+                    .nodes = 0,
+                    .cutoff = cutoff,
+                    .ply = ply + 1};
+  _join(thread);
+  int res = -_negamax(thread, min, max, depth, -b, -a);
+  _copy_line(thread, ply + 1, move, line);
+  _add_counts(thread);
+  return res;
+}
+
+// search the replies to a root move, the first one alone and then the rest
+// as parallel tasks (young brothers wait), cutting off every task once one
+// refutes the root move or the root's alpha rises past this node's rating;
+// `line` is set to the best reply and the line after it
+int _split_replies(_Search &search, Game &game, Player *max, Player *min,
+                   unsigned depth, std::atomic<int> &root_alpha, int root_b,
+                   Line &line) {
+  line.length = 0;
+  _RatedMoveList rated_moves;
+  _rate_moves(game, max, min, rated_moves);
+  if (rated_moves.empty()) {
+    return game.get_state(max) == Game::LOSS ? -MATE + 1 : 0;
+  }
+  int b = -root_alpha.load();
+  std::atomic<int> a(-root_b), rating(-INT_MAX);
+  int res = _search_copy(search, game, max->color, rated_moves.front().move, 1,
+                         depth - 1, a, b, nullptr, line);
+  _raise(rating, res);
+  _raise(a, res);
+  // the rating of the reply `line` was taken from
+  int line_rating = res;
+  std::mutex line_mutex;
+  std::atomic<bool> cutoff(a >= b);
+  ThreadPool::Group group;
+  for (_RatedMove *it = rated_moves.begin() + 1; it != rated_moves.end();
+       it++) {
+    Move move = it->move;
+    search.pool->submit(group, [&, move] {
+      int b = -root_alpha.load(), alpha = a.load();
+      if (cutoff || alpha >= b) {
+        cutoff = true;
+        return;
+      }
+      Line reply_line;
+      int res = _search_copy(search, game, max->color, move, 1, depth - 1,
+                             alpha, b, &cutoff, reply_line);
+      if (!cutoff && !search.stop) {
+        {
+          std::lock_guard<std::mutex> lock(line_mutex);
+          if (res > line_rating) {
+            line_rating = res;
+            line = reply_line;
+          }
+        }
+        _raise(rating, res);
+        _raise(a, res);
+        if (res >= b) {
+          cutoff = true;
+        }
+      }
+    });
   }
-  trans_table[hash_board] = new_entry;
+  search.pool->wait(group);
   return rating;
 }
 
-MoveChoice ai::best_move(Game &game, Player *player) {
+// rate each root move like `_search_root`, searching the first move alone
+// to set alpha and then the rest as parallel tasks that share it
+bool _split_root(_Search &search, Game &game, Player *max, Player *min,
+                 unsigned depth, int a, int b, _RatedMoveList &rated_moves,
+                 int &rating, Line &line) {
+  std::atomic<int> alpha(a), best(-INT_MAX);
+  // the rating of the root move `line` starts with
+  int line_rating = -INT_MAX;
+  std::mutex line_mutex;
+  line.length = 0;
+  ThreadPool::Group group;
+  for (_RatedMove *it = rated_moves.begin(); it != rated_moves.end(); it++) {
+    auto search_move = [&, it] {
+      if (alpha >= b) {
+        return;
+      }
+      Game copy = game;
+      Player *copy_max = max->color == BLACK ? &copy.black : &copy.white;
+      Player *copy_min = max->color == BLACK ? &copy.white : &copy.black;
+      copy.make_move(it->move);
+      int res;
+      Line root_line;
+      root_line.moves[0] = it->move;
+      if (split_replies && depth > 1) {
+        Line reply_line;
+        res = -_split_replies(search, copy, copy_min, copy_max, depth - 1,
+                              alpha, b, reply_line);
+        for (unsigned i = 0; i < reply_line.length; i++) {
+          root_line.moves[i + 1] = reply_line.moves[i];
+        }
+        root_line.length = reply_line.length + 1;
+      } else {
+        // a null window around alpha first, as in `_search_root`
+        _Thread thread = {
+            .game = copy, .search = search, .id = 0, .nodes = 0, .ply = 1};
+        _join(thread);
+        int alpha_before = alpha.load();
+        if (it == rated_moves.begin()) {
+          res = -_negamax(thread, copy_min, copy_max, depth - 1, -b,
+                          -alpha_before);
+        } else {
+          res = -_negamax(thread, copy_min, copy_max, depth - 1,
+                          -alpha_before - 1, -alpha_before);
+          if (res > alpha_before && res < b) {
+            res = -_negamax(thread, copy_min, copy_max, depth - 1, -b,
+                            -alpha.load());
+          }
+        }
+        _copy_line(thread, 1, it->move, root_line);
+        _add_counts(thread);
+      }
+      if (!search.stop) {
+        {
+          std::lock_guard<std::mutex> lock(line_mutex);
+          if (res > line_rating || !line.length) {
+            line_rating = res;
+            line = root_line;
+          }
+        }
+        it->rating = res;
+        _raise(best, res);
+        _raise(alpha, res);
+      }
+    };
+    // the first move sets alpha for the rest
+    if (it == rated_moves.begin()) {
+      search_move();
+    } else {
+      search.pool->submit(group, search_move);
+    }
+  }
+  search.pool->wait(group);
+  if (search.stop) {
+    return false;
+  }
+  rating = best;
+  rated_moves.sort();
+  return true;
+}
+
+// widen a bound of an aspiration window, saturating at a mate rating
+int _widen(int bound, long delta) {
+  return std::max((long)-INT_MAX, std::min((long)INT_MAX, bound + delta));
+}
+
+MoveChoice ai::best_move(Game &game, Player *player, Limits limits) {
   Player *max = player;
   Player *min = player == &game.black ? &game.white : &game.black;
-  std::vector<Move> moves = game.get_moves(max);
-  std::list<_RatedMove> rated_moves;
-  for (Move &move : moves) {
-    if (game.make_move(move)) {
-      rated_moves.push_back(
-          {.move = move,
-           .rating = _rate_player(game, max) - _rate_player(game, min)});
-      game.undo_move(move);
+  TranspositionTable &table = limits.table ? *limits.table : trans_table;
+  table.new_search();
+  // use the number of pieces to determine the search depth
+  unsigned num_pieces =
+      popcount(game.occupancy[BLACK] | game.occupancy[WHITE]);
+  unsigned max_depth = limits.depth;
+  if (!max_depth) {
+    max_depth = num_pieces > 14 ? 6 : (num_pieces > 8 ? 8 : 10);
+  }
+  if (verbose) {
+    printf("Searching to depth %u\n", max_depth);
+  }
+  _Search search = {.limits = limits,
+                    .table = table,
+                    .start_time = std::chrono::steady_clock::now()};
+  // drop what this thread counted outside of a search
+  STATS(thread_stats = {});
+  // start the helpers on their own copies of the game, since a game can only
+  // be searched by one thread
+  bool lazy_smp = search_mode == LAZY_SMP;
+  std::vector<Game> helper_games(
+      lazy_smp && num_threads > 1 ? num_threads - 1 : 0, game);
+  std::vector<std::thread> helpers;
+  for (unsigned i = 1; lazy_smp && i < num_threads; i++) {
+    helpers.emplace_back([&, i] {
+      _Thread thread = {
+          .game = helper_games[i - 1], .search = search, .id = i, .nodes = 0};
+      _helper_search(thread, player->color, max_depth);
+    });
+  }
+  if (!lazy_smp) {
+    std::lock_guard<std::mutex> lock(_pool_mutex);
+    if (!_pool || _pool->size() != num_threads) {
+      _pool = std::make_shared<ThreadPool>(num_threads);
     }
+    search.pool = _pool;
   }
-  rated_moves.sort(_RatedMove::best_move);
-  int rating = -INT_MAX;
-  std::map<_HashBoard, _Entry> trans_table;
-  // use the number of pieces to determine the search depth
-  unsigned num_pieces = 0;
-  for (Piece &piece : max->pieces) {
-    if (piece.is_live) {
-      num_pieces++;
+  _Thread thread = {.game = game, .search = search, .id = 0, .nodes = 0};
+  _join(thread);
+  _RatedMoveList rated_moves;
+  _rate_moves(game, max, min, rated_moves);
+  // in a tablebase endgame, only search the moves that keep the best result
+  // and reach it soonest
+  MoveList tb_moves;
+  for (_RatedMove &rated_move : rated_moves) {
+    tb_moves.push(rated_move.move);
+  }
+  if (popcount(game.occupancy[BLACK] | game.occupancy[WHITE]) <=
+          tb_probe_limit &&
+      syzygy::filter_root_moves(game, tb_moves)) {
+    search.tb_hits++;
+    unsigned kept = 0;
+    for (_RatedMove &rated_move : rated_moves) {
+      if (std::find(tb_moves.begin(), tb_moves.end(), rated_move.move) !=
+          tb_moves.end()) {
+        rated_moves.moves[kept++] = rated_move;
+      }
     }
+    rated_moves.size = kept;
   }
-  for (Piece &piece : min->pieces) {
-    if (piece.is_live) {
-      num_pieces++;
+  // search one ply deeper each iteration, keeping the best move of the last
+  // iteration that finished, and starting each iteration with a window around
+  // the last rating that is widened whenever the rating falls outside it
+  Move best = rated_moves.front().move;
+  int rating = rated_moves.front().rating;
+  Line line, pv;
+  pv.moves[0] = best;
+  pv.length = 1;
+  unsigned completed_depth = 0;
+  for (unsigned depth = 1; depth <= max_depth; depth++) {
+    long delta = ASPIRATION_WINDOW;
+    int a = depth > 1 ? _widen(rating, -delta) : -INT_MAX,
+        b = depth > 1 ? _widen(rating, delta) : INT_MAX;
+    bool finished;
+    for (;;) {
+      int res;
+      finished =
+          lazy_smp
+              ? _search_root(thread, max, min, depth, a, b, rated_moves, res,
+                             line)
+              : _split_root(search, game, max, min, depth, a, b,
+                            rated_moves, res, line);
+      if (!finished) {
+        break;
+      }
+      if (res <= a && a > -INT_MAX) {
+        a = _widen(a, -delta);
+      } else if (res >= b && b < INT_MAX) {
+        b = _widen(b, delta);
+      } else {
+        rating = res;
+        break;
+      }
+      delta *= 2;
+    }
+    if (!finished) {
+      break;
+    }
+    best = line.moves[0];
+    pv = line;
+    completed_depth = depth;
+    search.can_stop = true;
+    if (on_iteration) {
+      on_iteration({
+          .move = best,
+          .current_rating = 0,
+          .target_rating = rating,
+          .pv = pv,
+          .depth = depth,
+          .elapsed = _elapsed(search),
+          .nodes = _nodes(search),
+          .qnodes = search.qnodes,
+          .tb_hits = search.tb_hits,
+          .prunes = _prunes_so_far(thread),
+          .stats = _stats_so_far(search),
+      });
+    }
+    if (verbose) {
+      unsigned elapsed = _elapsed(search);
+      uint64_t nodes = _nodes(search);
+      printf("Depth %u: %.2f, %llu nodes, %llu nps, %u ms, pv ", depth,
+             rating / 100.0, (unsigned long long)nodes,
+             (unsigned long long)(nodes * 1000 / std::max(elapsed, 1u)),
+             elapsed);
+      print_line(pv);
+      printf("\n");
+    }
+    // another iteration would take longer than the time that is left
+    if (_pondering(search)) {
+      search.clock_start = _elapsed(search);
+    } else if (limits.movetime && _clock(search) * 2 > limits.movetime) {
+      break;
+    }
+    if (_stop_requested(search)) {
+      break;
     }
   }
-  unsigned depth = num_pieces > 14 ? 7 : (num_pieces > 8 ? 9 : 11);
-  printf("Searching to depth %u(+2 for capture)\n", depth - 2);
-  for (_RatedMove &rated_move : rated_moves) {
-    if (game.make_move(rated_move.move)) {
-      int res =
-          -_negamax(game, min, max, 7, -INT_MAX, -rating, -1, trans_table);
-      rated_move.rating = res;
-      rating = std::max(rating, res);
-      game.undo_move(rated_move.move);
+  search.stop = true;
+  for (std::thread &helper : helpers) {
+    helper.join();
+  }
+  _add_counts(thread);
+  if (verbose) {
+    uint64_t nodes = search.nodes, qnodes = search.qnodes;
+    printf("Nodes: %llu, %llu%% in quiescence\n", (unsigned long long)nodes,
+           (unsigned long long)(nodes ? qnodes * 100 / nodes : 0));
+    printf("Pruned: %llu null move (%llu refuted), %llu reduced (%llu "
+           "re-searched), %llu reverse futility, %llu futility\n",
+           (unsigned long long)search.prunes.null_move,
+           (unsigned long long)search.prunes.null_move_refuted,
+           (unsigned long long)search.prunes.reductions,
+           (unsigned long long)search.prunes.re_searches,
+           (unsigned long long)search.prunes.reverse_futility,
+           (unsigned long long)search.prunes.futility);
+    printf("Cutoffs: %llu, %.1f%% on the first move\n",
+           (unsigned long long)search.prunes.cutoffs,
+           search.prunes.cutoffs ? search.prunes.first_move_cutoffs * 100.0 /
+                                       search.prunes.cutoffs
+                                 : 0);
+    if (syzygy::max_pieces) {
+      printf("Tablebase hits: %llu\n", (unsigned long long)search.tb_hits);
     }
+    printf("Hash: %zuMB, %u%% full, %llu hits, %llu misses, %llu collisions\n",
+           table.size_mb(), table.hashfull() / 10,
+           (unsigned long long)table.hits(),
+           (unsigned long long)table.misses(),
+           (unsigned long long)table.collisions());
   }
-  rated_moves.sort(_RatedMove::best_move);
   return {
-      .move = rated_moves.front().move,
-      .current_rating = _rate_player(game, max) - _rate_player(game, min),
-      .target_rating = rated_moves.front().rating,
+      .move = best,
+      .current_rating = evaluate(game, max),
+      .target_rating = rating,
+      .pv = pv,
+      .depth = completed_depth,
+      .elapsed = _elapsed(search),
+      .nodes = search.nodes,
+      .qnodes = search.qnodes,
+      .tb_hits = search.tb_hits,
+      .prunes = search.prunes,
+      .stats = search.stats,
   };
 }
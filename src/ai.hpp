@@ -1,14 +1,124 @@
 #include "chess.hpp"
+#include "tt.hpp"
+#include <atomic>
 #pragma once
 
 namespace ai {
 
+// search results shared by every search for the rest of the game
+extern TranspositionTable trans_table;
+// number of threads searching each move, all sharing the table
+extern unsigned num_threads;
+// how threads share the work of a search: lazy smp has every thread search the
+// whole tree, while root splitting hands each root move to a work-stealing
+// thread pool
+enum SearchMode { LAZY_SMP, ROOT_SPLIT };
+extern SearchMode search_mode;
+// when splitting at the root, also split the replies to each root move once
+// the first reply has been searched
+extern bool split_replies;
+// print search progress to stdout
+extern bool verbose;
+// selective search: skip a move's subtree if passing the turn still fails
+// high, search late quiet moves to a reduced depth first, and near the leaves
+// cut off or skip quiet moves when the static rating is far outside the window
+extern bool null_move_pruning, late_move_reductions, futility_pruning;
+// positions with at most this many pieces, kings included, are looked up in
+// the endgame tablebases once any are found
+extern unsigned tb_probe_limit;
+
+// how often each kind of selective search fired, and how often nodes failed
+// high
+struct PruneCounts {
+  // cutoffs from passing the turn, and those discarded by a verification
+  // search in an endgame
+  uint64_t null_move, null_move_refuted;
+  // moves searched to a reduced depth, and how many of those had to be
+  // searched again at full depth
+  uint64_t reductions, re_searches;
+  // nodes cut off by their static rating, and quiet moves skipped by it
+  uint64_t reverse_futility, futility;
+  // nodes that failed high, and those that did on their first move
+  uint64_t cutoffs, first_move_cutoffs;
+
+  void add(const PruneCounts &other);
+};
+
+// what a search spent its nodes and time on, only counted in builds with
+// `SEARCH_STATS`
+struct SearchStats {
+  // transposition table lookups, and those that found their position
+  uint64_t tt_probes, tt_hits;
+  // nodes searched at each distance from the root, quiescence included
+  uint64_t ply_nodes[MAX_PLY];
+  // time spent generating moves, making and undoing them, and rating
+  // positions, in ticks of `stats_ticks`
+  uint64_t movegen_ticks, make_ticks, eval_ticks;
+
+  void add(const SearchStats &other);
+};
+
+// a sequence of moves from a position
+struct Line {
+  chess::Move moves[MAX_PLY];
+  unsigned length = 0;
+};
+
+// print a line's moves, separated by spaces
+void print_line(const Line &line);
+
+// when to stop searching, where zero means no limit; without a depth, the
+// depth is chosen from the number of pieces left
+struct Limits {
+  unsigned depth = 0;
+  uint64_t nodes = 0;
+  // milliseconds
+  unsigned movetime = 0;
+  // set by another thread to stop the search as soon as it has a move
+  const std::atomic<bool> *stop = nullptr;
+  // while set, the search ignores its node and time limits; once cleared, the
+  // movetime is counted from that moment
+  const std::atomic<bool> *ponder = nullptr;
+  // the table to search with instead of `trans_table`, so searches of
+  // different games running at once don't share results
+  TranspositionTable *table = nullptr;
+};
+
 struct MoveChoice {
   chess::Move move;
   int current_rating, target_rating;
+  // the moves both players are expected to make, starting with `move`, from
+  // the deepest iteration that finished
+  Line pv;
+  unsigned depth;
+  // milliseconds spent searching
+  unsigned elapsed;
+  // nodes searched by every thread, how many of those were in the
+  // quiescence search, and how many positions were found in the tablebases
+  uint64_t nodes, qnodes, tb_hits;
+  // both counted so far by the search, though helper threads only add theirs
+  // once the search ends
+  PruneCounts prunes;
+  SearchStats stats;
 };
 
-// find the best move given the current state for a given player
-MoveChoice best_move(chess::Game &game, chess::Player *player);
+// rating of checkmating the opponent, less the plies from the root to the
+// mate so nearer mates are preferred; ratings within `MAX_PLY` of it are mates
+#define MATE 1000000
+
+// the moves until the checkmate a rating is for, negative when the player
+// rated is the one mated, or 0 if the rating isn't a mate
+int mate_moves(int rating);
+
+// called from the searching thread after each iteration of `best_move`,
+// with the iteration's depth, rating, line and counts so far
+extern void (*on_iteration)(const MoveChoice &choice);
+
+// find the best move given the current state for a given player, searching
+// one ply deeper at a time until a limit is reached; searches of different
+// games can run at once on their own threads, sharing root splitting's pool,
+// which is only replaced between searches and kept alive by those using it
+MoveChoice best_move(chess::Game &game, chess::Player *player,
+                     Limits limits = {});
 
 } // namespace ai
@@ -0,0 +1,301 @@
+#include "batch.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+using namespace chess;
+using namespace ai;
+
+// a position of the file, with its EPD `id` if it has one
+struct _Position {
+  std::string fen, id;
+};
+
+// where finished games and analyses are written, one at a time
+struct _Output {
+  FILE *pgn = nullptr, *jsonl = nullptr;
+  std::mutex mutex;
+  unsigned finished = 0, total;
+  // games won by white, drawn and won by black
+  unsigned wins = 0, draws = 0, losses = 0;
+};
+
+// read the valid FEN or EPD lines of a file, skipping blank lines and those
+// starting with `#`
+bool _read_positions(const char *path, std::vector<_Position> &positions) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    return false;
+  }
+  char buffer[1024];
+  Game game;
+  while (fgets(buffer, sizeof(buffer), file)) {
+    std::string line = buffer;
+    while (!line.empty() && strchr("\r\n ", line.back())) {
+      line.pop_back();
+    }
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    if (!game.load_fen(line.c_str())) {
+      fprintf(stderr, "Invalid FEN %s\n", line.c_str());
+      continue;
+    }
+    _Position position = {.fen = game.get_fen(), .id = ""};
+    size_t id = line.find("id \"");
+    if (id != std::string::npos) {
+      position.id = line.substr(id + 4, line.find('"', id + 4) - id - 4);
+    }
+    positions.push_back(position);
+  }
+  fclose(file);
+  return true;
+}
+
+// quote a string for JSON
+std::string _json_string(const std::string &text) {
+  std::string json = "\"";
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      json += '\\';
+    }
+    json += c;
+  }
+  return json + "\"";
+}
+
+// determines if neither side has the pieces to mate: bare kings, or kings and
+// a single knight or bishop
+bool _insufficient_material(Game &game) {
+  Bitboard heavy = game.types[Piece::PAWN] | game.types[Piece::ROOK] |
+                   game.types[Piece::QUEEN];
+  Bitboard minor = game.types[Piece::KNIGHT] | game.types[Piece::BISHOP];
+  return !heavy && popcount(minor) <= 1;
+}
+
+// play a game against itself from a position, with its own table so games
+// running at once don't share results
+void _play(const _Position &position, unsigned round,
+           const batch::Options &options, _Output &output) {
+  Game game;
+  game.load_fen(position.fen.c_str());
+  TranspositionTable table(options.hash_mb);
+  Limits limits = options.limits;
+  limits.table = &table;
+  // the hash of every position so far, for finding repetitions
+  std::vector<uint64_t> hashes = {game.hash};
+  std::string result, termination, san_moves, moves;
+  uint64_t nodes = 0;
+  auto start = std::chrono::steady_clock::now();
+  unsigned plies = 0;
+  for (;;) {
+    Player *player = game.turn == WHITE ? &game.white : &game.black;
+    Game::State state = game.get_state(player);
+    if (state == Game::LOSS) {
+      result = game.turn == WHITE ? "0-1" : "1-0";
+      termination = "checkmate";
+      break;
+    }
+    result = "1/2-1/2";
+    if (state == Game::DRAW) {
+      termination = "stalemate";
+      break;
+    }
+    if (game.halfmove_clock >= 100) {
+      termination = "fifty moves";
+      break;
+    }
+    if (std::count(hashes.end() - std::min<size_t>(hashes.size(),
+                                                   game.halfmove_clock + 1),
+                   hashes.end(), game.hash) >= 3) {
+      termination = "repetition";
+      break;
+    }
+    if (_insufficient_material(game)) {
+      termination = "insufficient material";
+      break;
+    }
+    if (plies >= options.max_plies) {
+      termination = "adjudicated after " + std::to_string(plies) + " plies";
+      break;
+    }
+    MoveChoice choice = best_move(game, player, limits);
+    nodes += choice.nodes;
+    if (game.turn == WHITE || !plies) {
+      san_moves += std::to_string(game.fullmove_number) +
+                   (game.turn == WHITE ? ". " : "... ");
+    }
+    san_moves += game.get_san(choice.move) + " ";
+    char text[6];
+    choice.move.to_text(text);
+    moves += (plies ? " " : "") + std::string(text);
+    game.make_move(choice.move);
+    hashes.push_back(game.hash);
+    plies++;
+  }
+  unsigned elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+
+  std::lock_guard<std::mutex> lock(output.mutex);
+  output.finished++;
+  output.wins += result == "1-0";
+  output.draws += result == "1/2-1/2";
+  output.losses += result == "0-1";
+  fprintf(stderr, "Game %u/%u: %s by %s after %u plies\n", output.finished,
+          output.total, result.c_str(), termination.c_str(), plies);
+  if (output.pgn) {
+    char date[16];
+    time_t now = time(nullptr);
+    struct tm local;
+    strftime(date, sizeof(date), "%Y.%m.%d", localtime_r(&now, &local));
+    fprintf(output.pgn,
+            "[Event \"milkchess self-play\"]\n[Site \"?\"]\n[Date \"%s\"]\n"
+            "[Round \"%u\"]\n[White \"milkchess\"]\n[Black \"milkchess\"]\n"
+            "[Result \"%s\"]\n",
+            date, round, result.c_str());
+    if (position.fen != START_FEN) {
+      fprintf(output.pgn, "[FEN \"%s\"]\n[SetUp \"1\"]\n",
+              position.fen.c_str());
+    }
+    fprintf(output.pgn, "[PlyCount \"%u\"]\n\n", plies);
+    // wrap the moves, the termination and the result at 80 columns
+    std::string text = san_moves + "{" + termination + "} " + result, line;
+    size_t begin = 0;
+    while (begin < text.size()) {
+      size_t end = text.find(' ', begin);
+      end = end == std::string::npos ? text.size() : end;
+      std::string word = text.substr(begin, end - begin);
+      if (!line.empty() && line.size() + word.size() + 1 > 79) {
+        fprintf(output.pgn, "%s\n", line.c_str());
+        line.clear();
+      }
+      line += (line.empty() ? "" : " ") + word;
+      begin = end + 1;
+    }
+    fprintf(output.pgn, "%s\n\n", line.c_str());
+    fflush(output.pgn);
+  }
+  if (output.jsonl) {
+    fprintf(output.jsonl,
+            "{\"round\": %u, \"id\": %s, \"fen\": %s, \"result\": \"%s\", "
+            "\"termination\": %s, \"plies\": %u, \"moves\": \"%s\", "
+            "\"nodes\": %llu, \"time_ms\": %u}\n",
+            round, _json_string(position.id).c_str(),
+            _json_string(position.fen).c_str(), result.c_str(),
+            _json_string(termination).c_str(), plies, moves.c_str(),
+            (unsigned long long)nodes, elapsed);
+    fflush(output.jsonl);
+  }
+}
+
+// search a position once, with its own table
+void _analyse(const _Position &position, unsigned round,
+              const batch::Options &options, _Output &output) {
+  Game game;
+  game.load_fen(position.fen.c_str());
+  Player *player = game.turn == WHITE ? &game.white : &game.black;
+  TranspositionTable table(options.hash_mb);
+  Limits limits = options.limits;
+  limits.table = &table;
+  std::string score = "null", best = "null", pv;
+  MoveChoice choice = {};
+  if (game.get_state(player) == Game::IN_PLAY) {
+    choice = best_move(game, player, limits);
+    char text[6];
+    choice.move.to_text(text);
+    best = _json_string(text);
+    if (int moves = mate_moves(choice.target_rating)) {
+      score = "{\"mate\": " + std::to_string(moves) + "}";
+    } else {
+      score = "{\"cp\": " + std::to_string(choice.target_rating) + "}";
+    }
+    for (unsigned i = 0; i < choice.pv.length; i++) {
+      choice.pv.moves[i].to_text(text);
+      pv += (i ? " " : "") + std::string(text);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(output.mutex);
+  output.finished++;
+  fprintf(stderr, "Position %u/%u: %s\n", output.finished, output.total,
+          best.c_str());
+  if (output.jsonl) {
+    fprintf(output.jsonl,
+            "{\"round\": %u, \"id\": %s, \"fen\": %s, \"bestmove\": %s, "
+            "\"score\": %s, \"depth\": %u, \"nodes\": %llu, \"time_ms\": %u, "
+            "\"pv\": \"%s\"}\n",
+            round, _json_string(position.id).c_str(),
+            _json_string(position.fen).c_str(), best.c_str(), score.c_str(),
+            choice.depth, (unsigned long long)choice.nodes, choice.elapsed,
+            pv.c_str());
+    fflush(output.jsonl);
+  }
+}
+
+bool batch::run(const char *positions_path, const Options &options) {
+  std::vector<_Position> positions;
+  if (!_read_positions(positions_path, positions)) {
+    return false;
+  }
+  _Output output;
+  if (!options.pgn_path.empty() && !options.analyse &&
+      !(output.pgn = fopen(options.pgn_path.c_str(), "w"))) {
+    return false;
+  }
+  if (!options.jsonl_path.empty() &&
+      !(output.jsonl = fopen(options.jsonl_path.c_str(), "w"))) {
+    if (output.pgn) {
+      fclose(output.pgn);
+    }
+    return false;
+  }
+  if (!output.pgn && !output.jsonl) {
+    output.jsonl = stdout;
+  }
+  verbose = false;
+  on_iteration = nullptr;
+
+  // every game or analysis is a task, numbered by its round in the file
+  unsigned rounds = options.analyse ? 1 : std::max(options.rounds, 1u);
+  output.total = positions.size() * rounds;
+  auto start = std::chrono::steady_clock::now();
+  {
+    ThreadPool pool(options.concurrency);
+    ThreadPool::Group group;
+    for (unsigned i = 0; i < output.total; i++) {
+      const _Position &position = positions[i / rounds];
+      pool.submit(group, [&, i] {
+        if (options.analyse) {
+          _analyse(position, i + 1, options, output);
+        } else {
+          _play(position, i + 1, options, output);
+        }
+      });
+    }
+    pool.wait(group);
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  const char *kind = options.analyse ? "positions" : "games";
+  fprintf(stderr, "%s %u %s in %.1f s, %.0f %s per hour\n",
+          options.analyse ? "Analysed" : "Played", output.total, kind, seconds,
+          output.total * 3600 / std::max(seconds, 0.001), kind);
+  if (!options.analyse) {
+    fprintf(stderr, "White +%u =%u -%u\n", output.wins, output.draws,
+            output.losses);
+  }
+  for (FILE *file : {output.pgn, output.jsonl}) {
+    if (file && file != stdout) {
+      fclose(file);
+    }
+  }
+  return true;
+}
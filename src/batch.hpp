@@ -0,0 +1,31 @@
+#include "ai.hpp"
+#include <string>
+#pragma once
+
+namespace batch {
+
+// what a batch runs and where it writes the results, which go to stdout when
+// no file is given
+struct Options {
+  // play games against itself from each position, or analyse each position
+  bool analyse = false;
+  // games played from each position
+  unsigned rounds = 1;
+  // games or analyses run at once, each with its own game and table
+  unsigned concurrency = 1;
+  // megabytes of transposition table per game
+  size_t hash_mb = 16;
+  // plies after which a game still going is called a draw
+  unsigned max_plies = 400;
+  // the limits of every search
+  ai::Limits limits;
+  std::string pgn_path, jsonl_path;
+};
+
+// run a game or analysis for each FEN or EPD line of a file, writing each
+// game to PGN and each game or analysis to JSON lines as it finishes, and
+// report the games or analyses per hour, returning false if a file can't be
+// opened
+bool run(const char *positions_path, const Options &options);
+
+} // namespace batch
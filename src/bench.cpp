@@ -0,0 +1,597 @@
+#include "bench.hpp"
+#include "ai.hpp"
+#include "eval.hpp"
+#include "nnue.hpp"
+#include "perft.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <math.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+using namespace chess;
+
+// positions reached by playing moves from the starting position
+const char *_POSITIONS[] = {
+    "",
+    "e2e4 e7e5 g1f3 b8c6 f1c4 g8f6",
+    "d2d4 d7d5 c2c4 e7e6 b1c3 g8f6 c1g5 f8e7",
+    "e2e4 c7c5 g1f3 d7d6 d2d4 c5d4 f3d4 g8f6 b1c3 a7a6",
+};
+
+// play a sequence of moves on a game, returning the player to move next
+Player *_play(Game &game, const char *moves) {
+  Player *player = &game.white;
+  char text[6];
+  for (int length; sscanf(moves, " %5s%n", text, &length) == 1;
+       moves += length) {
+    Move move;
+    if (!game.parse_move(player, text, move)) {
+      printf("Invalid move %s\n", text);
+      break;
+    }
+    game.make_move(move);
+    player = player == &game.white ? &game.black : &game.white;
+  }
+  return player;
+}
+
+void bench::time_to_depth(unsigned depth) {
+  unsigned num_threads = ai::num_threads;
+  ai::SearchMode search_mode = ai::search_mode;
+  bool split_replies = ai::split_replies, verbose = ai::verbose;
+  ai::verbose = false;
+  const struct {
+    const char *name;
+    ai::SearchMode search_mode;
+    bool split_replies;
+  } modes[] = {
+      {"lazy smp", ai::LAZY_SMP, false},
+      {"root split", ai::ROOT_SPLIT, false},
+      {"root split+ybw", ai::ROOT_SPLIT, true},
+  };
+  printf("mode            threads  time (ms)  speedup\n");
+  for (auto mode : modes) {
+    ai::search_mode = mode.search_mode;
+    ai::split_replies = mode.split_replies;
+    double base_time = 0;
+    for (unsigned threads : {1, 2, 4, 8, 16}) {
+      ai::num_threads = threads;
+      double time = 0;
+      for (const char *position : _POSITIONS) {
+        Game game;
+        Player *player = _play(game, position);
+        ai::trans_table.clear();
+        auto start = std::chrono::steady_clock::now();
+        ai::best_move(game, player, {.depth = depth});
+        time += std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+      }
+      if (threads == 1) {
+        base_time = time;
+      }
+      printf("%-14s  %7u  %9.0f  %6.2fx\n", mode.name, threads, time,
+             base_time / time);
+    }
+  }
+  ai::num_threads = num_threads;
+  ai::search_mode = search_mode;
+  ai::split_replies = split_replies;
+  ai::verbose = verbose;
+}
+
+void bench::eval_speed() {
+  const unsigned num_positions = sizeof(_POSITIONS) / sizeof(*_POSITIONS),
+                 num_evals = 10000000;
+  ai::Evaluator evaluator = ai::evaluator;
+  bool use_mobility = ai::use_mobility;
+  ai::NnueKernel nnue_kernel = ai::nnue_kernel;
+  const struct {
+    const char *name;
+    ai::Evaluator evaluator;
+    bool use_mobility;
+    ai::NnueKernel nnue_kernel;
+  } evaluators[] = {
+      {"tables", ai::HAND_WRITTEN, false},
+      {"tables+mobility", ai::HAND_WRITTEN, true},
+      {"nnue scalar", ai::NEURAL_NETWORK, false, ai::SCALAR},
+      {"nnue sse4.1", ai::NEURAL_NETWORK, false, ai::SSE41},
+      {"nnue avx2", ai::NEURAL_NETWORK, false, ai::AVX2},
+  };
+  printf("evaluator        evals/s\n");
+  for (auto evaluator : evaluators) {
+    if (evaluator.evaluator == ai::NEURAL_NETWORK &&
+        (!ai::network || !ai::kernel_supported(evaluator.nnue_kernel))) {
+      continue;
+    }
+    ai::evaluator = evaluator.evaluator;
+    ai::use_mobility = evaluator.use_mobility;
+    ai::nnue_kernel = evaluator.nnue_kernel;
+    // sum the ratings so the evaluations can't be optimized out
+    long total = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const char *position : _POSITIONS) {
+      Game game;
+      Player *player = _play(game, position);
+      for (unsigned i = 0; i < num_evals / num_positions; i++) {
+        total += ai::evaluate(game, player);
+      }
+    }
+    double time = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+    printf("%-15s  %6.1fM  (%ld)\n", evaluator.name, num_evals / time / 1e6,
+           total);
+  }
+  ai::evaluator = evaluator;
+  ai::use_mobility = use_mobility;
+  ai::nnue_kernel = nnue_kernel;
+}
+
+// positions from every phase of the game, including a few endgames and
+// positions with castling, en passant and promotions available
+const char *_BENCH_FENS[] = {
+    START_FEN,
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 11",
+    "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+    "rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
+    "r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
+    "r3r1k1/2p2ppp/p1p1bn2/8/1q2P3/2NPQN2/PPP3PP/R4RK1 b - - 2 15",
+    "r1bbk1nr/pp3p1p/2n5/1N4p1/2Np1B2/8/PPP2PPP/2KR1B1R w kq - 0 13",
+    "r1bq1rk1/ppp1nppp/4n3/3p3Q/3P4/1BP1B3/PP1N2PP/R4RK1 w - - 1 16",
+    "4r1k1/r1q2ppp/ppp2n2/4P3/5Rb1/1N1BQ3/PPP3PP/R5K1 w - - 1 17",
+    "2rqkb1r/ppp2p2/2npb1p1/1N1Nn2p/2P1PP2/8/PP2B1PP/R1BQK2R b KQ - 0 11",
+    "r1bq1r1k/b1p1npp1/p2p3p/1p6/3PP3/1B2NN2/PP3PPP/R2Q1RK1 w - - 1 16",
+    "3r1rk1/p5pp/bpp1pp2/8/q1PP1P2/b3P3/P2NQRPP/1R2B1K1 b - - 6 22",
+    "r1q2rk1/2p1bppp/2Pp4/p6b/Q1PNp3/4B3/PP1R1PPP/2K4R w - - 2 18",
+    "4k2r/1pb2ppp/1p2p3/1R1p4/3P4/2r1PN2/P4PPP/1R4K1 b - - 3 22",
+    "3q2k1/pb3p1p/4pbp1/2r5/PpN2N2/1P2P2P/5PP1/Q2R2K1 b - - 4 26",
+    "6k1/6p1/6Pp/ppp5/3pn2P/1P3K2/1PP2P2/8 b - - 3 54",
+    "3b4/5kp1/1p1p1p1p/pP1PpP1P/P1P1P3/3KN3/8/8 w - - 0 1",
+    "2K5/p7/7P/5pR1/8/5k2/r7/8 w - - 0 1",
+    "8/6pk/1p6/8/PP3p1p/5P2/4KP1q/3Q4 w - - 0 1",
+    "7k/3p2pp/4q3/8/4Q3/5Kp1/P6b/8 w - - 0 1",
+    "8/2p5/8/2kPKp1p/2p4P/2P5/3P4/8 w - - 0 1",
+    "8/1p3pp1/7p/5P1P/2k3P1/8/2K2P2/8 w - - 0 1",
+    "8/pp2r1k1/2p1p3/3pP2p/1P1P1P1P/P5KR/8/8 w - - 0 1",
+    "8/3p4/p1bk3p/Pp6/1Kp1PpPp/2P2P1P/2P5/5B2 b - - 0 1",
+    "5k2/7R/4P2p/5K2/p1r2P1p/8/8/8 b - - 0 1",
+    "6k1/6p1/P6p/r1N5/5p2/7P/1b3PP1/4R1K1 w - - 0 1",
+    "1r3k2/4q3/2Pp3b/3Bp3/2Q2p2/1p1P2P1/1P2KP2/3N4 w - - 0 1",
+    "6k1/4pp1p/3p2p1/P1pPb3/R7/1r2P1PP/3B1P2/6K1 w - - 0 1",
+    "8/3p3B/5p2/5P2/p7/PP5b/k7/6K1 w - - 0 1",
+    "5rk1/q6p/2p3bR/1pPp1rP1/1P1Pp3/P3B1Q1/1K3P2/R7 w - - 93 90",
+    "4rrk1/1p1nq3/p7/2p1P1pp/3P2bp/3Q1Bn1/PPPB4/1K2R1NR w - - 40 21",
+    "r3k2r/3nnpbp/q2pp1p1/p7/Pp1PPPP1/4BNN1/1P5P/R2Q1RK1 w kq - 0 16",
+    "3Qb1k1/1r2ppb1/pN1n2q1/Pp1Pp1Pr/4P2p/4BP2/4B1R1/1R5K b - - 11 40",
+    "4k3/3q1r2/1N2r1b1/3ppN2/2nPP3/1B1R2n1/2R1Q3/3K4 w - - 5 1",
+    "8/8/8/8/5kp1/P7/8/1K1N4 w - - 0 1",
+    "8/8/8/5N2/8/p7/8/2NK3k w - - 0 1",
+    "8/3k4/8/8/8/4B3/4KB2/2B5 w - - 0 1",
+    "8/8/1P6/5pr1/8/4R3/7k/2K5 w - - 0 1",
+    "8/2p4P/8/kr6/6R1/8/8/1K6 w - - 0 1",
+    "8/8/3P3k/8/1p6/8/1P6/1K3n2 b - - 0 1",
+    "8/R7/2q5/8/6k1/8/1P5p/K6R w - - 0 124",
+    "6k1/3b3r/1p1p4/p1n2p2/1PPNpP1q/P3Q1p1/1R1RB1P1/5K2 b - - 0 1",
+    "r2r1n2/pp2bk2/2p1p2p/3q4/3PN1QP/2P3R1/P4PP1/5RK1 w - - 0 1",
+};
+
+void bench::search_suite(unsigned depth, bool json) {
+  unsigned num_threads = ai::num_threads;
+  ai::SearchMode search_mode = ai::search_mode;
+  bool verbose = ai::verbose;
+  // a single thread searches the same tree every time, so its node count
+  // identifies the search
+  ai::num_threads = 1;
+  ai::search_mode = ai::LAZY_SMP;
+  ai::verbose = false;
+  uint64_t nodes = 0, qnodes = 0, hits = 0, misses = 0;
+  ai::PruneCounts prunes = {};
+  double time = 0;
+  if (json) {
+    printf("{\n  \"depth\": %u,\n  \"positions\": [\n", depth);
+  }
+  const unsigned num_positions = sizeof(_BENCH_FENS) / sizeof(*_BENCH_FENS);
+  for (unsigned i = 0; i < num_positions; i++) {
+    Game game;
+    if (!game.load_fen(_BENCH_FENS[i])) {
+      printf("Invalid FEN %s\n", _BENCH_FENS[i]);
+      continue;
+    }
+    // every position is searched from an empty table, so its count doesn't
+    // depend on the positions before it
+    ai::trans_table.clear();
+    auto start = std::chrono::steady_clock::now();
+    ai::MoveChoice choice = ai::best_move(
+        game, game.turn == WHITE ? &game.white : &game.black,
+        {.depth = depth});
+    double position_time = std::chrono::duration<double, std::milli>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+    time += position_time;
+    nodes += choice.nodes;
+    qnodes += choice.qnodes;
+    hits += ai::trans_table.hits();
+    misses += ai::trans_table.misses();
+    prunes.add(choice.prunes);
+    char move[6];
+    choice.move.to_text(move);
+    if (json) {
+      printf("    {\"fen\": \"%s\", \"move\": \"%s\", \"nodes\": %llu, "
+             "\"time_ms\": %.1f}%s\n",
+             _BENCH_FENS[i], move, (unsigned long long)choice.nodes,
+             position_time, i + 1 < num_positions ? "," : "");
+    } else {
+      printf("Position %2u/%u: %-5s %10llu nodes %8.0f ms\n", i + 1,
+             num_positions, move, (unsigned long long)choice.nodes,
+             position_time);
+    }
+  }
+  double hit_rate = hits + misses ? (double)hits / (hits + misses) : 0;
+  uint64_t nps = nodes * 1000 / std::max(time, 1.0);
+  double first_move_rate =
+      prunes.cutoffs ? (double)prunes.first_move_cutoffs / prunes.cutoffs : 0;
+  if (json) {
+    printf("  ],\n  \"nodes\": %llu,\n  \"qnodes\": %llu,\n  \"time_ms\": "
+           "%.0f,\n  \"nps\": %llu,\n  \"tt_hit_rate\": %.4f,\n  "
+           "\"prunes\": {\"null_move\": %llu, \"null_move_refuted\": %llu, "
+           "\"reductions\": %llu, \"re_searches\": %llu, "
+           "\"reverse_futility\": %llu, \"futility\": %llu},\n  "
+           "\"cutoffs\": %llu,\n  \"first_move_cutoff_rate\": %.4f\n}\n",
+           (unsigned long long)nodes, (unsigned long long)qnodes, time,
+           (unsigned long long)nps, hit_rate,
+           (unsigned long long)prunes.null_move,
+           (unsigned long long)prunes.null_move_refuted,
+           (unsigned long long)prunes.reductions,
+           (unsigned long long)prunes.re_searches,
+           (unsigned long long)prunes.reverse_futility,
+           (unsigned long long)prunes.futility,
+           (unsigned long long)prunes.cutoffs, first_move_rate);
+  } else {
+    printf("\nDepth: %u\n", depth);
+    printf("Nodes: %llu, %llu%% in quiescence\n", (unsigned long long)nodes,
+           (unsigned long long)(nodes ? qnodes * 100 / nodes : 0));
+    printf("Time: %.0f ms, %llu nodes per second\n", time,
+           (unsigned long long)nps);
+    printf("Hash: %.1f%% hit rate\n", hit_rate * 100);
+    printf("Pruned: %llu null move (%llu refuted), %llu reduced (%llu "
+           "re-searched), %llu reverse futility, %llu futility\n",
+           (unsigned long long)prunes.null_move,
+           (unsigned long long)prunes.null_move_refuted,
+           (unsigned long long)prunes.reductions,
+           (unsigned long long)prunes.re_searches,
+           (unsigned long long)prunes.reverse_futility,
+           (unsigned long long)prunes.futility);
+    printf("Cutoffs: %llu, %.1f%% on the first move\n",
+           (unsigned long long)prunes.cutoffs, first_move_rate * 100);
+  }
+  ai::num_threads = num_threads;
+  ai::search_mode = search_mode;
+  ai::verbose = verbose;
+}
+
+void bench::make_speed(unsigned depth) {
+  const unsigned num_copies = 100000000;
+  printf("mode        nodes/s\n");
+  for (bool copy_make : {false, true}) {
+    uint64_t nodes = 0;
+    double time = 0;
+    for (const char *fen : _BENCH_FENS) {
+      Game game;
+      game.load_fen(fen);
+      game.copy_make = copy_make;
+      auto start = std::chrono::steady_clock::now();
+      nodes += perft(game, depth);
+      time += std::chrono::duration<double>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+    }
+    printf("%-10s  %6.1fM  (%llu)\n", copy_make ? "copy-make" : "make/undo",
+           nodes / time / 1e6, (unsigned long long)nodes);
+  }
+  // copy back and forth between two positions, with a compiler barrier so
+  // the copies can't be optimized out
+  Game game;
+  Position positions[2] = {game, game};
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < num_copies; i++) {
+    positions[i & 1] = positions[~i & 1];
+    asm volatile("" : : "r"(positions) : "memory");
+  }
+  double time = std::chrono::duration<double, std::nano>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+  printf("copying a %zu byte position: %.2f ns\n", sizeof(Position),
+         time / num_copies);
+}
+
+void bench::search_stats(unsigned depth, const char *trace_path) {
+#ifndef SEARCH_STATS
+  printf("Built without SEARCH_STATS, so only nodes and times are counted; "
+         "rebuild with `make STATS=1`\n");
+#endif
+  if (trace_path && !ai::open_trace(trace_path)) {
+    printf("Could not open %s\n", trace_path);
+    return;
+  }
+  bool verbose = ai::verbose;
+  auto on_iteration = ai::on_iteration;
+  ai::verbose = false;
+  ai::on_iteration = ai::trace_iteration;
+  uint64_t nodes = 0, qnodes = 0;
+  ai::SearchStats stats = {};
+  ai::PruneCounts prunes = {};
+  double time = 0;
+  const unsigned num_positions = sizeof(_BENCH_FENS) / sizeof(*_BENCH_FENS);
+  for (unsigned i = 0; i < num_positions; i++) {
+    Game game;
+    if (!game.load_fen(_BENCH_FENS[i])) {
+      printf("Invalid FEN %s\n", _BENCH_FENS[i]);
+      continue;
+    }
+    ai::trans_table.clear();
+    auto start = std::chrono::steady_clock::now();
+    ai::MoveChoice choice = ai::best_move(
+        game, game.turn == WHITE ? &game.white : &game.black,
+        {.depth = depth});
+    double position_time = std::chrono::duration<double, std::milli>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+    ai::trace_search(_BENCH_FENS[i], choice);
+    time += position_time;
+    nodes += choice.nodes;
+    qnodes += choice.qnodes;
+    stats.add(choice.stats);
+    prunes.add(choice.prunes);
+    const ai::SearchStats &s = choice.stats;
+    const ai::PruneCounts &p = choice.prunes;
+    printf("Position %2u/%u: %10llu nodes %8.0f ms, %5.1f%% hash hits, "
+           "%5.1f%% first move cutoffs\n",
+           i + 1, num_positions, (unsigned long long)choice.nodes,
+           position_time, s.tt_probes ? s.tt_hits * 100.0 / s.tt_probes : 0,
+           p.cutoffs ? p.first_move_cutoffs * 100.0 / p.cutoffs : 0);
+  }
+  ai::verbose = verbose;
+  ai::on_iteration = on_iteration;
+  ai::close_trace();
+
+  double tick_ms = ai::stats_tick_ns() / 1e6;
+  printf("\nNodes: %llu, %llu%% in quiescence\n", (unsigned long long)nodes,
+         (unsigned long long)(nodes ? qnodes * 100 / nodes : 0));
+  printf("Hash: %llu probes, %.1f%% hits\n",
+         (unsigned long long)stats.tt_probes,
+         stats.tt_probes ? stats.tt_hits * 100.0 / stats.tt_probes : 0);
+  printf("Cutoffs: %llu, %.1f%% on the first move\n",
+         (unsigned long long)prunes.cutoffs,
+         prunes.cutoffs ? prunes.first_move_cutoffs * 100.0 / prunes.cutoffs
+                        : 0);
+  printf("Time: %.0f ms, %.0f ms generating moves, %.0f ms making and "
+         "undoing moves, %.0f ms rating positions\n",
+         time, stats.movegen_ticks * tick_ms, stats.make_ticks * tick_ms,
+         stats.eval_ticks * tick_ms);
+  // the branching factor at a ply is how many nodes the next ply has for
+  // each of its nodes
+  printf("\nply      nodes  branching\n");
+  for (unsigned ply = 0; ply < MAX_PLY && stats.ply_nodes[ply]; ply++) {
+    printf("%3u %10llu %10.2f\n", ply, (unsigned long long)stats.ply_nodes[ply],
+           ply + 1 < MAX_PLY ? (double)stats.ply_nodes[ply + 1] /
+                                   stats.ply_nodes[ply]
+                             : 0);
+  }
+}
+
+// how long an operation of a kernel takes: the median and fastest of the
+// samples in nanoseconds, how far the samples spread around the median
+// relative to it, and the median in ticks of the time stamp counter
+struct _Timing {
+  double median_ns, min_ns, spread, ticks;
+};
+
+// time a kernel that does its operation on every position of a corpus,
+// returning how many it did; it runs for a while first so the caches and
+// branch predictors are warm and a sample is long enough to time reliably
+_Timing _time_kernel(const std::function<uint64_t()> &kernel) {
+  const unsigned num_samples = 21;
+  const double sample_ns = 10e6, warmup_ns = 100e6;
+  // time some repeats of the kernel, returning the nanoseconds and ticks per
+  // operation
+  auto sample = [&](unsigned repeats, double &ns, double &ticks) {
+    uint64_t ops = 0, start_ticks = ai::stats_ticks();
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < repeats; i++) {
+      ops += kernel();
+    }
+    double elapsed = std::chrono::duration<double, std::nano>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    ticks = (double)(ai::stats_ticks() - start_ticks) / ops;
+    ns = elapsed / ops;
+    return elapsed;
+  };
+  unsigned repeats = 1;
+  double ns, ticks, warmed = 0;
+  while (warmed < warmup_ns) {
+    double elapsed = sample(repeats, ns, ticks);
+    warmed += elapsed;
+    if (elapsed < sample_ns) {
+      repeats *= 2;
+    }
+  }
+  std::vector<double> samples_ns, samples_ticks;
+  for (unsigned i = 0; i < num_samples; i++) {
+    sample(repeats, ns, ticks);
+    samples_ns.push_back(ns);
+    samples_ticks.push_back(ticks);
+  }
+  std::sort(samples_ns.begin(), samples_ns.end());
+  std::sort(samples_ticks.begin(), samples_ticks.end());
+  double median = samples_ns[num_samples / 2];
+  // the median absolute deviation, scaled to match a standard deviation for
+  // normal noise, since a sample interrupted by another process shouldn't
+  // count for much
+  std::vector<double> deviations;
+  for (double value : samples_ns) {
+    deviations.push_back(fabs(value - median));
+  }
+  std::sort(deviations.begin(), deviations.end());
+  return {
+      .median_ns = median,
+      .min_ns = samples_ns[0],
+      .spread = 1.4826 * deviations[num_samples / 2] / median,
+      .ticks = samples_ticks[num_samples / 2],
+  };
+}
+
+bool bench::micro(const char *baseline_path, const char *save_path) {
+  // the benchmark positions and every position a move from them, with the
+  // legal moves of each
+  std::vector<Game> games;
+  std::vector<MoveList> moves;
+  for (const char *fen : _BENCH_FENS) {
+    Game game;
+    game.load_fen(fen);
+    MoveList first_moves;
+    game.get_moves(game.turn == WHITE ? &game.white : &game.black,
+                   first_moves);
+    games.push_back(game);
+    for (Move move : first_moves) {
+      games.push_back(game);
+      games.back().make_move(move);
+    }
+  }
+  for (Game &game : games) {
+    moves.emplace_back();
+    game.get_moves(game.turn == WHITE ? &game.white : &game.black,
+                   moves.back());
+  }
+  ai::TranspositionTable table(16);
+
+  // each kernel sums something of its results so they can't be optimized out
+  uint64_t total = 0;
+  const struct {
+    const char *name;
+    std::function<uint64_t()> run;
+  } kernels[] = {
+      {"get_moves",
+       [&] {
+         MoveList list;
+         for (Game &game : games) {
+           game.get_moves(game.turn == WHITE ? &game.white : &game.black,
+                          list);
+           total += list.size;
+         }
+         return games.size();
+       }},
+      {"make+undo",
+       [&] {
+         uint64_t ops = 0;
+         for (unsigned i = 0; i < games.size(); i++) {
+           for (Move move : moves[i]) {
+             games[i].make_move(move);
+             total += games[i].hash;
+             games[i].undo_move(move);
+           }
+           ops += moves[i].size;
+         }
+         return ops;
+       }},
+      {"is_check",
+       [&] {
+         for (Game &game : games) {
+           total += game.is_check(game.turn == WHITE ? &game.white
+                                                     : &game.black);
+         }
+         return games.size();
+       }},
+      {"evaluate",
+       [&] {
+         for (Game &game : games) {
+           total += ai::evaluate(game, game.turn == WHITE ? &game.white
+                                                          : &game.black);
+         }
+         return games.size();
+       }},
+      {"tt_store",
+       [&] {
+         for (Game &game : games) {
+           table.store(game.hash, {.rating = (int32_t)game.hash,
+                                   .move = 0,
+                                   .depth = 1,
+                                   .flag = ai::TTEntry::EXACT});
+         }
+         return games.size();
+       }},
+      {"tt_probe",
+       [&] {
+         ai::TTEntry entry;
+         for (Game &game : games) {
+           total += table.probe(game.hash, entry);
+         }
+         return games.size();
+       }},
+  };
+
+  // the fastest nanoseconds of each kernel from the baseline
+  std::vector<std::pair<std::string, double>> baseline;
+  if (baseline_path) {
+    FILE *file = fopen(baseline_path, "r");
+    if (!file) {
+      printf("Could not open %s\n", baseline_path);
+      return false;
+    }
+    char name[32];
+    double median_ns, min_ns;
+    while (fscanf(file, " %31s %lf %lf", name, &median_ns, &min_ns) == 3) {
+      baseline.push_back({name, min_ns});
+    }
+    fclose(file);
+  }
+  FILE *save = nullptr;
+  if (save_path && !(save = fopen(save_path, "w"))) {
+    printf("Could not open %s\n", save_path);
+    return false;
+  }
+
+  printf("%zu positions\n", games.size());
+  // the time stamp counter runs at a fixed rate rather than the core's clock,
+  // so its ticks aren't cycles once the core's frequency changes
+  printf("Time stamp counter: %.3f GHz\n", 1 / ai::stats_tick_ns());
+  printf("kernel       ns/op   min ns  spread  TSC ticks/op%s\n",
+         baseline.empty() ? "" : "  vs baseline");
+  bool slower = false;
+  for (auto &kernel : kernels) {
+    _Timing timing = _time_kernel(kernel.run);
+    printf("%-10s  %6.2f   %6.2f  %5.1f%%  %12.1f", kernel.name,
+           timing.median_ns, timing.min_ns, timing.spread * 100, timing.ticks);
+    for (auto &entry : baseline) {
+      if (entry.first != kernel.name) {
+        continue;
+      }
+      // the fastest samples are the least disturbed by the rest of the
+      // machine, and only count as a change beyond the noise of the samples
+      double change = timing.min_ns / entry.second - 1,
+             noise = std::max(0.02, 3 * timing.spread);
+      printf("  %+10.1f%%%s", change * 100,
+             change > noise    ? " slower"
+             : change < -noise ? " faster"
+                               : "");
+      slower |= change > noise;
+    }
+    printf("\n");
+    if (save) {
+      fprintf(save, "%s %.3f %.3f\n", kernel.name, timing.median_ns,
+              timing.min_ns);
+    }
+  }
+  if (save) {
+    fclose(save);
+  }
+  // print the sum, so the work that made it is done
+  printf("(%llu)\n", (unsigned long long)total);
+  return !slower;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+namespace bench {
+
+// time searches of a few fixed positions to a depth using 1 to 16 threads in
+// each search mode
+void time_to_depth(unsigned depth);
+// count the evaluations per second of a few fixed positions, with and without
+// mobility and, if a network is loaded, with each kernel the CPU supports
+void eval_speed();
+// search a fixed set of positions to a depth on one thread, printing the total
+// nodes, which only change when the search does, along with the nodes per
+// second, hash hit rate and prune counts, as text or as JSON
+void search_suite(unsigned depth, bool json);
+// count the perft nodes per second of the benchmark positions to a depth when
+// moves are undone by reversing them and when the position from before the
+// move is copied back, along with the time to copy a position
+void make_speed(unsigned depth);
+// search the benchmark positions to a depth, printing each one's hash hit and
+// first-move cutoff rates, then the totals with the time spent in each step of
+// the search and the branching factor at each ply, and writing a Chrome trace
+// of the iterations if a path is given; only nodes and times are counted
+// unless built with `SEARCH_STATS`
+void search_stats(unsigned depth, const char *trace_path);
+// time the steps of the search on their own, over the benchmark positions and
+// the positions a move from them, printing the median and fastest nanoseconds
+// per operation, how much the samples vary and the time stamp counter ticks
+// per operation; the times are saved to a file if a path is given, and the
+// fastest compared to those of a saved baseline, returning false if any got
+// slower by more than the noise
+bool micro(const char *baseline_path, const char *save_path);
+
+} // namespace bench
@@ -0,0 +1,163 @@
+#include "bitboard.hpp"
+#include "chess.hpp"
+
+using namespace chess;
+
+Bitboard chess::KNIGHT_ATTACKS[64], chess::KING_ATTACKS[64],
+    chess::PAWN_ATTACKS[2][64];
+Bitboard chess::BETWEEN[64][64], chess::LINE[64][64];
+Magic chess::ROOK_MAGICS[64], chess::BISHOP_MAGICS[64];
+bool chess::USE_PEXT = false;
+
+// backing storage for every square's sliding attacks, sized by the total
+// number of blocker subsets across all squares
+Bitboard _rook_table[0x19000], _bishop_table[0x1480];
+
+// get the squares reached by stepping once from a square by each delta
+Bitboard _step_attacks(uint8_t x, uint8_t y, const Delta *deltas,
+                       uint8_t num_deltas) {
+  Bitboard attacks = 0;
+  for (uint8_t i = 0; i < num_deltas; i++) {
+    uint8_t to_x = x + deltas[i].x, to_y = y + deltas[i].y;
+    if (to_x < BOARD_SIZE && to_y < BOARD_SIZE) {
+      attacks |= bit(square(to_x, to_y));
+    }
+  }
+  return attacks;
+}
+
+// get the squares reached by sliding from a square along each delta, up to
+// and including the first occupied square; if `mask` is set, the last square
+// of each ray is left off since it cannot block anything
+Bitboard _slide_attacks(uint8_t x, uint8_t y, const Delta *deltas,
+                        Bitboard occupied, bool mask = false) {
+  Bitboard attacks = 0;
+  for (uint8_t i = 0; i < 4; i++) {
+    for (uint8_t d = 1;; d++) {
+      uint8_t to_x = x + (d + mask) * deltas[i].x,
+              to_y = y + (d + mask) * deltas[i].y;
+      if (to_x >= BOARD_SIZE || to_y >= BOARD_SIZE) {
+        break;
+      }
+      Bitboard target = bit(square(x + d * deltas[i].x, y + d * deltas[i].y));
+      attacks |= target;
+      if (occupied & target) {
+        break;
+      }
+    }
+  }
+  return attacks;
+}
+
+// multipliers that map every blocker subset of each square to a distinct
+// (or harmlessly shared) index, found offline by a random search over sparse
+// 64-bit numbers
+const Bitboard _ROOK_MAGIC_NUMBERS[64] = {
+    0x1080004008801020ull, 0x0840092002c03000ull, 0x1900200010400900ull,
+    0x0880100008000480ull, 0x4200100420080200ull, 0x8100020100080400ull,
+    0x0200040110886200ull, 0x0200008040220411ull, 0x0404800084400220ull,
+    0x0000401000402000ull, 0x0086001081220440ull, 0x0408800800100280ull,
+    0x000a001201040820ull, 0x8848800200840080ull, 0x4001000100040200ull,
+    0x0442000102105084ull, 0x9080010020804100ull, 0x0040404000201009ull,
+    0x0000808010002009ull, 0x2200090021d00100ull, 0x0008008008040080ull,
+    0x0004004002010040ull, 0x0011040008015042ull, 0x00000a0001768104ull,
+    0x0000800080204009ull, 0x2010004140002001ull, 0x9800200280100080ull,
+    0x1000100080080080ull, 0x0442000a00049020ull, 0x2100040080020080ull,
+    0x0800120400900148ull, 0x0010040a00128541ull, 0x2800804000800030ull,
+    0x1010002000400041ull, 0x4000200011004100ull, 0x0610008410800800ull,
+    0x0400802402800800ull, 0xc100020080800400ull, 0x0002000802000401ull,
+    0x0182085882000401ull, 0x0220204000808000ull, 0x2860100040024022ull,
+    0x0001002004110040ull, 0x99101042000a0020ull, 0x0004080004008080ull,
+    0x0010040002008080ull, 0x2012004881020004ull, 0x8300842444820011ull,
+    0x0088403882010200ull, 0x0820400080210100ull, 0x0110910040a00300ull,
+    0x0801100280080480ull, 0x0242009008200600ull, 0x1002000489500200ull,
+    0x0040800200010080ull, 0x0091800041000080ull, 0x0000209300488001ull,
+    0x04c1002414824001ull, 0x020020000b001041ull, 0x7000100004200901ull,
+    0x8002002004100802ull, 0x30010002084c0007ull, 0x0888221800813004ull,
+    0x4000002840840112ull,
+};
+const Bitboard _BISHOP_MAGIC_NUMBERS[64] = {
+    0x1010900200902200ull, 0x0260046086204080ull, 0x0804087081012c80ull,
+    0x0008208a240a1084ull, 0x0004042080020020ull, 0x8019100210008080ull,
+    0x0400480444212004ull, 0xa200240c02882800ull, 0xa0a0042008410102ull,
+    0x064a08010802004aull, 0x0008080204322440ull, 0x0031280600400200ull,
+    0x0000240504100c00ull, 0x1404020804040400ull, 0x39a0042104022012ull,
+    0x0000802092101005ull, 0x0010602420021c44ull, 0x2020000802841044ull,
+    0x15c0800802031022ull, 0x0084000804240800ull, 0x0013002820080001ull,
+    0x050102008080c008ull, 0x8040882062082000ull, 0x5001840044208810ull,
+    0x0002400110108201ull, 0x0110080022424421ull, 0x0800a60410040844ull,
+    0x1144040080410200ull, 0x0106001002005001ull, 0x1811050012048080ull,
+    0x80020c0800410800ull, 0x8001204011040880ull, 0x048484404a200284ull,
+    0x0000901004040480ull, 0x5224004800210204ull, 0x05a6008020020201ull,
+    0x0010220200002008ull, 0x0632080201404044ull, 0x100801004c010818ull,
+    0x0011012601a10444ull, 0x0004112441071021ull, 0x8812021004060314ull,
+    0x0000082690000801ull, 0xc000020212000400ull, 0x0000084104002442ull,
+    0x0081100101100200ull, 0x7288816102018404ull, 0x9408008c0048208aull,
+    0x08040c0208440200ull, 0x0000440088080400ull, 0x00200d0290d00160ull,
+    0x4000000020880008ull, 0x000840a002048001ull, 0x0001204410208400ull,
+    0x4040880280861288ull, 0x20103c0800604100ull, 0x050841040101c000ull,
+    0x2020102401241040ull, 0x4a12000024020800ull, 0x3201000c00420200ull,
+    0xa559000004050408ull, 0x1102440892080a10ull, 0x0400402849046080ull,
+    0x0060111001090121ull,
+};
+
+// fill the lookup tables of one slider type, indexed by `pext` if available
+// and by the magic multipliers otherwise
+void _init_magics(Magic *magics, Bitboard *table, const Delta *deltas,
+                  const Bitboard *magic_numbers) {
+  for (uint8_t sq = 0; sq < 64; sq++) {
+    uint8_t x = sq % BOARD_SIZE, y = sq / BOARD_SIZE;
+    Magic &magic = magics[sq];
+    magic.mask = _slide_attacks(x, y, deltas, 0, true);
+    magic.magic = magic_numbers[sq];
+    magic.shift = 64 - popcount(magic.mask);
+    magic.attacks = table;
+    // enumerate every subset of the mask
+    Bitboard occupied = 0;
+    do {
+      unsigned index = USE_PEXT ? pext(occupied, magic.mask)
+                                : (occupied * magic.magic) >> magic.shift;
+      magic.attacks[index] = _slide_attacks(x, y, deltas, occupied);
+      occupied = (occupied - magic.mask) & magic.mask;
+    } while (occupied);
+    table += (Bitboard)1 << (64 - magic.shift);
+  }
+}
+
+// fill the attack tables before any game is created
+static struct _AttackTables {
+  _AttackTables() {
+    const Delta black_pawn_deltas[] = {{-1, 1}, {1, 1}},
+                white_pawn_deltas[] = {{-1, -1}, {1, -1}};
+    for (uint8_t y = 0; y < BOARD_SIZE; y++) {
+      for (uint8_t x = 0; x < BOARD_SIZE; x++) {
+        uint8_t sq = square(x, y);
+        KNIGHT_ATTACKS[sq] = _step_attacks(x, y, KNIGHT_DELTAS, 8);
+        KING_ATTACKS[sq] = _step_attacks(x, y, KING_DELTAS, 8);
+        PAWN_ATTACKS[BLACK][sq] = _step_attacks(x, y, black_pawn_deltas, 2);
+        PAWN_ATTACKS[WHITE][sq] = _step_attacks(x, y, white_pawn_deltas, 2);
+      }
+    }
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    USE_PEXT = __builtin_cpu_supports("bmi2");
+#endif
+    _init_magics(ROOK_MAGICS, _rook_table, HORZ_VERT_DETLAS,
+                 _ROOK_MAGIC_NUMBERS);
+    _init_magics(BISHOP_MAGICS, _bishop_table, DIAGONAL_DELTAS,
+                 _BISHOP_MAGIC_NUMBERS);
+    // a line runs through two squares where each is a slider's attack from
+    // the other on an empty board, and the squares between are the overlap
+    // of their attacks with each blocking the other
+    for (uint8_t a = 0; a < 64; a++) {
+      for (uint8_t b = 0; b < 64; b++) {
+        for (auto attacks : {rook_attacks, bishop_attacks}) {
+          if (a != b && attacks(a, 0) & bit(b)) {
+            LINE[a][b] = (attacks(a, 0) & attacks(b, 0)) | bit(a) | bit(b);
+            BETWEEN[a][b] = attacks(a, bit(b)) & attacks(b, bit(a));
+          }
+        }
+      }
+    }
+  }
+} _attack_tables;
@@ -0,0 +1,80 @@
+#include <stdint.h>
+#pragma once
+
+namespace chess {
+
+// a set of squares, one bit per square indexed by `y * 8 + x`
+typedef uint64_t Bitboard;
+
+// precomputed attacks from each square, pawn attacks indexed by color
+extern Bitboard KNIGHT_ATTACKS[64], KING_ATTACKS[64], PAWN_ATTACKS[2][64];
+
+// for two squares on the same rank, file or diagonal, the squares strictly
+// between them, and the whole line through both; empty otherwise
+extern Bitboard BETWEEN[64][64], LINE[64][64];
+
+// sliding attack lookup for a single square, indexed by the occupancy of the
+// squares that can block it
+struct Magic {
+  Bitboard mask, magic;
+  Bitboard *attacks;
+  uint8_t shift;
+};
+
+extern Magic ROOK_MAGICS[64], BISHOP_MAGICS[64];
+
+// whether the sliding tables are indexed with `pext` rather than multiplies,
+// chosen once at startup when the CPU supports BMI2
+extern bool USE_PEXT;
+
+inline uint8_t square(uint8_t x, uint8_t y) { return y * 8 + x; }
+
+inline Bitboard bit(uint8_t square) { return (Bitboard)1 << square; }
+
+inline uint8_t lsb(Bitboard bitboard) { return __builtin_ctzll(bitboard); }
+
+inline uint8_t msb(Bitboard bitboard) { return 63 ^ __builtin_clzll(bitboard); }
+
+// remove and return the lowest square in the set
+inline uint8_t pop_lsb(Bitboard &bitboard) {
+  uint8_t square = lsb(bitboard);
+  bitboard &= bitboard - 1;
+  return square;
+}
+
+inline unsigned popcount(Bitboard bitboard) {
+  return __builtin_popcountll(bitboard);
+}
+
+// gather the bits of `bitboard` selected by `mask` into the low bits, only
+// valid when `USE_PEXT` is set
+inline uint64_t pext(Bitboard bitboard, Bitboard mask) {
+#if defined(__x86_64__)
+  uint64_t result;
+  asm("pextq %2, %1, %0" : "=r"(result) : "r"(bitboard), "rm"(mask));
+  return result;
+#else
+  return 0;
+#endif
+}
+
+inline Bitboard slider_attacks(const Magic &magic, Bitboard occupied) {
+  if (USE_PEXT) {
+    return magic.attacks[pext(occupied, magic.mask)];
+  }
+  return magic.attacks[((occupied & magic.mask) * magic.magic) >> magic.shift];
+}
+
+inline Bitboard rook_attacks(uint8_t square, Bitboard occupied) {
+  return slider_attacks(ROOK_MAGICS[square], occupied);
+}
+
+inline Bitboard bishop_attacks(uint8_t square, Bitboard occupied) {
+  return slider_attacks(BISHOP_MAGICS[square], occupied);
+}
+
+inline Bitboard queen_attacks(uint8_t square, Bitboard occupied) {
+  return rook_attacks(square, occupied) | bishop_attacks(square, occupied);
+}
+
+} // namespace chess
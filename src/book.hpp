@@ -0,0 +1,38 @@
+#include "chess.hpp"
+#pragma once
+
+namespace book {
+
+// the Polyglot key a position is looked up by, which only counts the en
+// passant square when a pawn of the player to move can take there, so
+// transpositions share moves
+uint64_t key(chess::Game &game);
+
+// map a book of 16-byte Polyglot entries (key, move, weight and learn data,
+// big-endian and sorted by key) into memory, replacing any opened before,
+// returning false if it can't be read
+bool open(const char *path);
+
+// unmap the book, if one is open
+void close();
+
+// find the game's legal moves in the book along with their weights, returning
+// the number found
+unsigned find(chess::Game &game, chess::MoveList &moves,
+              uint16_t weights[MAX_MOVES]);
+
+// pick one of the book's moves for the game at random, by weight, returning
+// false if the position isn't in the book
+bool probe(chess::Game &game, chess::Move &move);
+
+// check keys against the reference keys of the Polyglot book format, printing
+// each one's outcome as `Game::test` does, and returning false if any is wrong
+bool test();
+
+// read the games of a PGN file up to `max_ply` plies in, scoring each move 2
+// for a win, 1 for a draw and 0 for a loss, and write every move that scored
+// to a book, returning false if either file can't be opened; games with an
+// illegal move or a starting position that can't be loaded are skipped
+bool build(const char *pgn_path, const char *book_path, unsigned max_ply);
+
+} // namespace book
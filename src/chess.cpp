@@ -1,354 +1,746 @@
 #include "chess.hpp"
+#include "nnue.hpp"
+#include "perft.hpp"
+#include "stats.hpp"
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 using namespace chess;
 
-Game::Game() {
-  // initialize game
-  black.color = BLACK;
-  white.color = WHITE;
-  const Piece::Type piece_order[] = {
-      Piece::ROOK, Piece::KNIGHT, Piece::BISHOP, Piece::QUEEN,
-      Piece::KING, Piece::BISHOP, Piece::KNIGHT, Piece::ROOK, /* first row */
-      Piece::PAWN, Piece::PAWN,   Piece::PAWN,   Piece::PAWN,
-      Piece::PAWN, Piece::PAWN,   Piece::PAWN,   Piece::PAWN /* second row */
-  };
-  for (uint32_t i = 0; i < BOARD_SIZE * BOARD_SIZE; i++) {
-    board[i / BOARD_SIZE][i % BOARD_SIZE] = nullptr;
-  }
-  for (uint8_t i = 0; i < sizeof(piece_order) / sizeof(Piece::Type); ++i) {
-    uint8_t x = i % BOARD_SIZE, black_y = i / BOARD_SIZE,
-            white_y = BOARD_SIZE - i / BOARD_SIZE - 1;
-    black.pieces[i] = {
-        .color = BLACK,
-        .type = piece_order[i],
-        .x = x,
-        .y = black_y,
-    };
-    white.pieces[i] = {
-        .color = WHITE,
-        .type = piece_order[i],
-        .x = x,
-        .y = white_y,
-    };
-    if (piece_order[i] == Piece::KING) {
-      black.king = &black.pieces[i];
-      white.king = &white.pieces[i];
-    }
-    board[black_y][x] = &black.pieces[i];
-    board[white_y][x] = &white.pieces[i];
+uint64_t chess::ZOBRIST_PIECES[2][Piece::KING + 1][64],
+    chess::ZOBRIST_CASTLING[16], chess::ZOBRIST_EN_PASSANT[BOARD_SIZE],
+    chess::ZOBRIST_SIDE;
+
+// fill the zobrist keys before any game is created
+static struct _ZobristKeys {
+  uint64_t seed = 0x2545f4914f6cdd1dull;
+
+  uint64_t random() {
+    seed ^= seed >> 12;
+    seed ^= seed << 25;
+    seed ^= seed >> 27;
+    return seed * 2685821657736338717ull;
+  }
+
+  _ZobristKeys() {
+    for (auto &keys : ZOBRIST_PIECES) {
+      for (auto &square_keys : keys) {
+        for (uint64_t &key : square_keys) {
+          key = random();
+        }
+      }
+    }
+    for (uint64_t &key : ZOBRIST_CASTLING) {
+      key = random();
+    }
+    for (uint64_t &key : ZOBRIST_EN_PASSANT) {
+      key = random();
+    }
+    ZOBRIST_SIDE = random();
   }
+} _zobrist_keys;
+
+void Move::to_text(char *text) const {
+  text[0] = 'a' + x1();
+  text[1] = '8' - y1();
+  text[2] = 'a' + x2();
+  text[3] = '8' - y2();
+  text[4] = " pnbrqk"[promotion_type()];
+  text[promotion_type() ? 5 : 4] = '\0';
 }
 
-bool Game::is_check(Player *player) {
-  // check for pawns
-  uint8_t y = player->king->y + (player->color == BLACK ? 1 : -1);
-  uint8_t x = player->king->x - 1;
-  if (x < BOARD_SIZE && y < BOARD_SIZE) {
-    Piece *attacker = board[y][x];
-    if (attacker && attacker->color != player->color &&
-        attacker->type == Piece::PAWN) {
-      return true;
+Game::Game() { load_fen(START_FEN); }
+
+// the castling rights kept when a move leaves or lands on each square, so
+// moving a king or rook, or taking a rook, gives up the rights that rely on it
+static const struct _CastlingMasks {
+  uint8_t masks[64];
+  _CastlingMasks() {
+    memset(masks, 0xff, sizeof(masks));
+    masks[0] = (uint8_t)~BLACK_QUEENSIDE;
+    masks[4] = (uint8_t) ~(BLACK_QUEENSIDE | BLACK_KINGSIDE);
+    masks[7] = (uint8_t)~BLACK_KINGSIDE;
+    masks[56] = (uint8_t)~WHITE_QUEENSIDE;
+    masks[60] = (uint8_t) ~(WHITE_QUEENSIDE | WHITE_KINGSIDE);
+    masks[63] = (uint8_t)~WHITE_KINGSIDE;
+  }
+} _CASTLING_MASKS;
+
+bool Game::load_fen(const char *fen) {
+  char placement[BOARD_SIZE * BOARD_SIZE + BOARD_SIZE], side, castling_text[5],
+      en_passant_text[3];
+  unsigned halfmoves = 0, fullmoves = 1;
+  if (sscanf(fen, " %71s %c %4s %2s %u %u", placement, &side, castling_text,
+             en_passant_text, &halfmoves, &fullmoves) < 4 ||
+      (side != 'w' && side != 'b') ||
+      (strcmp(castling_text, "-") &&
+       strspn(castling_text, "KQkq") != strlen(castling_text)) ||
+      (strcmp(en_passant_text, "-") &&
+       (en_passant_text[0] < 'a' || en_passant_text[0] > 'h' ||
+        (en_passant_text[1] != '3' && en_passant_text[1] != '6')))) {
+    return false;
+  }
+  // read the pieces into a scratch board, rank 8 first, so nothing changes
+  // unless the whole placement is valid
+  uint8_t placed[BOARD_SIZE * BOARD_SIZE] = {};
+  unsigned kings[2] = {0, 0};
+  uint8_t x = 0, y = 0;
+  for (const char *c = placement; *c; c++) {
+    if (*c == '/') {
+      if (x != BOARD_SIZE || ++y == BOARD_SIZE) {
+        return false;
+      }
+      x = 0;
+    } else if (*c >= '1' && *c <= '8') {
+      x += *c - '0';
+      if (x > BOARD_SIZE) {
+        return false;
+      }
+    } else {
+      const char *symbol = strchr("pnbrqkPNBRQK", *c);
+      if (!symbol || x == BOARD_SIZE) {
+        return false;
+      }
+      Color color = symbol - "pnbrqkPNBRQK" < 6 ? BLACK : WHITE;
+      Piece::Type type =
+          (Piece::Type)((symbol - "pnbrqkPNBRQK") % 6 + Piece::PAWN);
+      if (type == Piece::PAWN && (y == 0 || y == BOARD_SIZE - 1)) {
+        return false;
+      }
+      placed[square(x, y)] = color << 3 | type;
+      x++;
+      kings[color] += type == Piece::KING;
     }
   }
-  x = player->king->x + 1;
-  if (x < BOARD_SIZE && y < BOARD_SIZE) {
-    Piece *attacker = board[y][x];
-    if (attacker && attacker->color != player->color &&
-        attacker->type == Piece::PAWN) {
-      return true;
+  if (x != BOARD_SIZE || y != BOARD_SIZE - 1 || kings[BLACK] != 1 ||
+      kings[WHITE] != 1) {
+    return false;
+  }
+  // an en passant target is the empty square a pawn of the player that just
+  // moved skipped over: on rank 6 with white to move, or rank 3 with black
+  // to move, with the pawn on the square in front of it
+  uint8_t target = NO_SQUARE;
+  if (strcmp(en_passant_text, "-")) {
+    Color moved = side == 'w' ? BLACK : WHITE;
+    if (en_passant_text[1] != (moved == BLACK ? '6' : '3')) {
+      return false;
+    }
+    target = square(en_passant_text[0] - 'a', '8' - en_passant_text[1]);
+    uint8_t pawn = moved == BLACK ? target + BOARD_SIZE : target - BOARD_SIZE;
+    if (placed[target] || placed[pawn] != (moved << 3 | Piece::PAWN)) {
+      return false;
     }
   }
-  // check for knights
-  for (Delta delta : KNIGHT_DELTAS) {
-    x = player->king->x + delta.x;
-    y = player->king->y + delta.y;
-    if (x < BOARD_SIZE && y < BOARD_SIZE) {
-      Piece *attacker = board[y][x];
-      if (attacker && attacker->color != player->color &&
-          attacker->type == Piece::KNIGHT) {
-        return true;
-      }
+
+  black.color = BLACK;
+  white.color = WHITE;
+  Position &position = *this;
+  memset(&position, 0, sizeof(Position));
+  for (uint8_t sq = 0; sq < BOARD_SIZE * BOARD_SIZE; sq++) {
+    if (placed[sq]) {
+      _toggle((Color)(placed[sq] >> 3), (Piece::Type)(placed[sq] & 7), sq);
     }
   }
-  // check for other king
-  for (Delta delta : KING_DELTAS) {
-    x = player->king->x + delta.x;
-    y = player->king->y + delta.y;
-    if (x < BOARD_SIZE && y < BOARD_SIZE) {
-      Piece *attacker = board[y][x];
-      if (attacker && attacker->color != player->color &&
-          attacker->type == Piece::KING) {
-        return true;
+  // rights without their king and rook in place are ignored
+  if (strcmp(castling_text, "-")) {
+    for (const char *c = castling_text; *c; c++) {
+      uint8_t index = strchr("qkQK", *c) - "qkQK";
+      Color color = index < 2 ? BLACK : WHITE;
+      uint8_t back_rank = color == BLACK ? 0 : BOARD_SIZE - 1;
+      uint8_t rook = square(index % 2 ? BOARD_SIZE - 1 : 0, back_rank);
+      if (squares[square(4, back_rank)] == (color << 3 | Piece::KING) &&
+          squares[rook] == (color << 3 | Piece::ROOK)) {
+        castling |= 1 << index;
       }
     }
   }
-  // check for horizontal/vertical pieces
-  for (Delta delta : HORZ_VERT_DETLAS) {
-    for (uint8_t d = 1;; d++) {
-      x = player->king->x + d * delta.x;
-      y = player->king->y + d * delta.y;
-      if (x >= BOARD_SIZE || y >= BOARD_SIZE) {
-        break;
+
+  turn = side == 'w' ? WHITE : BLACK;
+  halfmove_clock = halfmoves;
+  fullmove_number = std::max(fullmoves, 1u);
+  en_passant = target;
+  hash = _compute_hash();
+  _history.clear();
+  _positions.clear();
+  _accumulators.clear();
+  if (ai::network) {
+    ai::network->refresh(*this);
+  }
+  return true;
+}
+
+std::string Game::get_fen() {
+  std::string fen;
+  for (uint8_t y = 0; y < BOARD_SIZE; y++) {
+    unsigned empty = 0;
+    for (uint8_t x = 0; x < BOARD_SIZE; x++) {
+      Piece piece = piece_at(square(x, y));
+      if (!piece.type) {
+        empty++;
+        continue;
       }
-      Piece *attacker = board[y][x];
-      if (attacker) {
-        if (attacker->color != player->color &&
-            (attacker->type == Piece::ROOK || attacker->type == Piece::QUEEN)) {
-          return true;
-        }
-        break;
+      if (empty) {
+        fen += '0' + empty;
+        empty = 0;
       }
+      fen += (piece.color == BLACK ? " pnbrqk" : " PNBRQK")[piece.type];
+    }
+    if (empty) {
+      fen += '0' + empty;
     }
+    fen += y < BOARD_SIZE - 1 ? '/' : ' ';
   }
-  for (Delta delta : DIAGONAL_DELTAS) {
-    for (uint8_t d = 1;; d++) {
-      x = player->king->x + d * delta.x;
-      y = player->king->y + d * delta.y;
-      if (x >= BOARD_SIZE || y >= BOARD_SIZE) {
-        break;
-      }
-      Piece *attacker = board[y][x];
-      if (attacker) {
-        if (attacker->color != player->color &&
-            (attacker->type == Piece::BISHOP ||
-             attacker->type == Piece::QUEEN)) {
-          return true;
-        }
-        break;
-      }
+  fen += turn == WHITE ? "w " : "b ";
+  for (uint8_t i = 0; i < 4; i++) {
+    if (castling & 0b1000 >> i) {
+      fen += "KQkq"[i];
     }
   }
-  return false;
+  fen += castling ? " " : "- ";
+  if (en_passant != NO_SQUARE) {
+    fen += 'a' + en_passant % BOARD_SIZE;
+    fen += '8' - en_passant / BOARD_SIZE;
+  } else {
+    fen += '-';
+  }
+  char counters[32];
+  snprintf(counters, sizeof(counters), " %u %u", halfmove_clock,
+           fullmove_number);
+  return fen + counters;
 }
 
-std::vector<Move> Game::get_moves(Player *player) {
-  std::vector<Move> moves;
-  for (Piece &piece : player->pieces) {
-    if (!piece.is_live) {
-      continue;
+uint64_t Game::_compute_hash() {
+  uint64_t hash = ZOBRIST_CASTLING[castling];
+  for (Bitboard pieces = occupancy[BLACK] | occupancy[WHITE]; pieces;) {
+    uint8_t sq = pop_lsb(pieces);
+    Piece piece = piece_at(sq);
+    hash ^= ZOBRIST_PIECES[piece.color][piece.type][sq];
+  }
+  if (en_passant != NO_SQUARE) {
+    hash ^= ZOBRIST_EN_PASSANT[en_passant % BOARD_SIZE];
+  }
+  return hash ^ (turn == BLACK ? ZOBRIST_SIDE : 0);
+}
+
+bool Game::is_attacked(uint8_t square, Color attacker) {
+  return _is_attacked(square, attacker, occupancy[BLACK] | occupancy[WHITE]);
+}
+
+bool Game::_is_attacked(uint8_t square, Color attacker, Bitboard occupied) {
+  Bitboard own = occupancy[attacker];
+  return (PAWN_ATTACKS[opponent(attacker)][square] & types[Piece::PAWN] &
+          own) ||
+         (KNIGHT_ATTACKS[square] & types[Piece::KNIGHT] & own) ||
+         (KING_ATTACKS[square] & types[Piece::KING] & own) ||
+         (rook_attacks(square, occupied) &
+          (types[Piece::ROOK] | types[Piece::QUEEN]) & own) ||
+         (bishop_attacks(square, occupied) &
+          (types[Piece::BISHOP] | types[Piece::QUEEN]) & own);
+}
+
+bool Game::is_check(Player *player) {
+  return is_attacked(king_square(player->color), opponent(player->color));
+}
+
+void Game::_toggle(Color color, Piece::Type type, uint8_t square) {
+  // the piece is being added if the square is empty
+  int sign = squares[square] ? -1 : 1;
+  const Score &score = PIECE_SQUARE_SCORES[color][type][square];
+  psqt[color].mg += sign * score.mg;
+  psqt[color].eg += sign * score.eg;
+  phase += sign * PHASE_WEIGHTS[type];
+  if (ai::network) {
+    ai::network->update(accumulator, color, type, square, sign);
+  }
+  squares[square] = sign > 0 ? color << 3 | type : 0;
+  types[type] ^= bit(square);
+  occupancy[color] ^= bit(square);
+  hash ^= ZOBRIST_PIECES[color][type][square];
+}
+
+void Game::_add_moves(MoveList &moves, uint8_t from, Bitboard targets) {
+  while (targets) {
+    moves.push(Move(from, pop_lsb(targets)));
+  }
+}
+
+Game::_Constraints Game::_constraints(Color color) {
+  Color enemy = opponent(color);
+  uint8_t king = king_square(color);
+  Bitboard occupied = occupancy[BLACK] | occupancy[WHITE];
+  Bitboard rooks = pieces(enemy, Piece::ROOK) | pieces(enemy, Piece::QUEEN),
+           bishops =
+               pieces(enemy, Piece::BISHOP) | pieces(enemy, Piece::QUEEN);
+  Bitboard checkers =
+      (PAWN_ATTACKS[color][king] & pieces(enemy, Piece::PAWN)) |
+      (KNIGHT_ATTACKS[king] & pieces(enemy, Piece::KNIGHT)) |
+      (rook_attacks(king, occupied) & rooks) |
+      (bishop_attacks(king, occupied) & bishops);
+  _Constraints constraints = {
+      .king = king,
+      .in_check = checkers != 0,
+      .check_mask = ~(Bitboard)0,
+      .pinned = 0,
+  };
+  // a single check is answered by blocking or taking the checking piece, and
+  // a double check only by moving the king
+  if (checkers) {
+    constraints.check_mask = popcount(checkers) > 1
+                                 ? 0
+                                 : BETWEEN[king][lsb(checkers)] | checkers;
+  }
+  // a piece is pinned when it is all that stands between the king and an
+  // enemy slider
+  Bitboard snipers =
+      (rook_attacks(king, 0) & rooks) | (bishop_attacks(king, 0) & bishops);
+  while (snipers) {
+    Bitboard between = BETWEEN[king][pop_lsb(snipers)] & occupied;
+    if (popcount(between) == 1 && (between & occupancy[color])) {
+      constraints.pinned |= between;
     }
-    // pawn movement
-    if (piece.type == Piece::PAWN) {
-      int8_t dir = piece.color == BLACK ? 1 : -1;
-      // double move forward
-      uint8_t x = piece.x;
-      uint8_t intermediate = piece.y + dir;
-      uint8_t y = piece.y + 2 * dir;
-      if (!piece.has_moved && !board[intermediate][x] && !board[y][x]) {
-        moves.push_back(Move(&piece, x, y));
+  }
+  return constraints;
+}
+
+void Game::_add_piece_moves(MoveList &moves, uint8_t from, MoveKind kind,
+                            const _Constraints &constraints) {
+  Piece piece = piece_at(from);
+  Color enemy_color = opponent(piece.color);
+  Bitboard own = occupancy[piece.color], enemy = occupancy[enemy_color];
+  Bitboard occupied = own | enemy;
+  uint8_t x1 = from % BOARD_SIZE, y1 = from / BOARD_SIZE;
+  // the squares each kind of move may land on, besides pawn moves
+  Bitboard allowed = kind == CAPTURES ? enemy
+                     : kind == QUIETS ? ~occupied
+                                      : ~own;
+  // the squares that keep the king safe, for any piece but the king
+  Bitboard legal = constraints.check_mask;
+  if (constraints.pinned & bit(from)) {
+    legal &= LINE[constraints.king][from];
+  }
+  // pawn movement
+  if (piece.type == Piece::PAWN) {
+    int8_t dir = piece.color == BLACK ? 1 : -1;
+    uint8_t y = y1 + dir;
+    bool promotion = y == 0 || y == 7;
+    // double move forward, from the pawn's starting rank
+    uint8_t y2 = y1 + 2 * dir;
+    if (kind != CAPTURES && y1 == (piece.color == BLACK ? 1 : 6) &&
+        !squares[square(x1, y)] && !squares[square(x1, y2)] &&
+        (legal & bit(square(x1, y2)))) {
+      moves.push(Move(from, square(x1, y2)));
+    }
+    // standard move forward and piece taking, where promotions and taking
+    // count as captures
+    Bitboard targets = 0;
+    if (kind != (promotion ? QUIETS : CAPTURES)) {
+      targets |= bit(square(x1, y)) & ~occupied;
+    }
+    if (kind != QUIETS) {
+      targets |= PAWN_ATTACKS[piece.color][from] & enemy;
+    }
+    targets &= legal;
+    // check each for pawn promotion
+    if (promotion) {
+      while (targets) {
+        uint8_t to = pop_lsb(targets);
+        for (Piece::Type promotion_type :
+             {Piece::KNIGHT, Piece::BISHOP, Piece::ROOK, Piece::QUEEN}) {
+          moves.push(Move(from, to, promotion_type));
+        }
       }
-      // check each for pawn promotion
-      y = piece.y + dir;
-      std::vector<Piece::Type> promotion_options = {Piece::NONE};
-      if (y == 0 || y == 7) {
-        promotion_options = {Piece::KNIGHT, Piece::BISHOP, Piece::ROOK,
-                             Piece::QUEEN};
+    } else {
+      _add_moves(moves, from, targets);
+    }
+    // en passant, which is rare enough to test directly since it removes two
+    // pieces from the capturing rank
+    if (kind != QUIETS && en_passant != NO_SQUARE &&
+        (PAWN_ATTACKS[piece.color][from] & bit(en_passant))) {
+      Move move(from, en_passant);
+      if (!_leaves_check(move, piece.color,
+                         square(en_passant % BOARD_SIZE, y1))) {
+        moves.push(move);
       }
-      for (Piece::Type promotion_type : promotion_options) {
-        x = piece.x;
-        // standard move forward
-        if (!board[y][x]) {
-          moves.push_back(Move(&piece, x, y, nullptr, promotion_type));
-        }
-        // piece taking
-        x = piece.x - 1;
-        if (x < BOARD_SIZE && board[y][x] &&
-            board[y][x]->color != player->color) {
-          moves.push_back(Move(&piece, x, y, board[y][x], promotion_type));
-        }
-        x = piece.x + 1;
-        if (x < BOARD_SIZE && board[y][x] &&
-            board[y][x]->color != player->color) {
-          moves.push_back(Move(&piece, x, y, board[y][x], promotion_type));
-        }
+    }
+  }
+  // knight movement
+  else if (piece.type == Piece::KNIGHT) {
+    _add_moves(moves, from, KNIGHT_ATTACKS[from] & allowed & legal);
+  }
+  // king movement, to squares that aren't attacked once the king has left
+  // its own, so it can't step back along a checking slider's line
+  else if (piece.type == Piece::KING) {
+    for (Bitboard targets = KING_ATTACKS[from] & allowed; targets;) {
+      uint8_t to = pop_lsb(targets);
+      if (!_is_attacked(to, enemy_color, occupied ^ bit(from))) {
+        moves.push(Move(from, to));
+      }
+    }
+    // check for castling, where the king may not pass through or land on an
+    // attacked square; holding the right means the king and rook are in
+    // place
+    if (kind != CAPTURES && !constraints.in_check) {
+      uint8_t queenside =
+          piece.color == BLACK ? BLACK_QUEENSIDE : WHITE_QUEENSIDE;
+      if ((castling & queenside) && !squares[square(1, y1)] &&
+          !squares[square(2, y1)] && !squares[square(3, y1)] &&
+          !is_attacked(square(3, y1), enemy_color) &&
+          !is_attacked(square(2, y1), enemy_color)) {
+        moves.push(Move(from, square(2, y1)));
       }
-      // en passant
-      if (last_pawn_adv2 && last_pawn_adv2->y == piece.y &&
-          std::abs((int)last_pawn_adv2->x - piece.x) == 1) {
-        moves.push_back(Move(&piece, last_pawn_adv2->x, y, last_pawn_adv2));
+      if ((castling & queenside << 1) && !squares[square(5, y1)] &&
+          !squares[square(6, y1)] &&
+          !is_attacked(square(5, y1), enemy_color) &&
+          !is_attacked(square(6, y1), enemy_color)) {
+        moves.push(Move(from, square(6, y1)));
       }
     }
-    // knight movement
-    else if (piece.type == Piece::KNIGHT) {
-      for (Delta delta : KNIGHT_DELTAS) {
-        uint8_t x = piece.x + delta.x;
-        uint8_t y = piece.y + delta.y;
-        if (x < BOARD_SIZE && y < BOARD_SIZE) {
-          if (!board[y][x]) {
-            moves.push_back(Move(&piece, x, y));
-          } else if (board[y][x]->color != player->color) {
-            moves.push_back(Move(&piece, x, y, board[y][x]));
-          }
-        }
+  } else {
+    // horizontal/vertical and diagonal sliding
+    Bitboard targets = 0;
+    if (piece.type == Piece::ROOK || piece.type == Piece::QUEEN) {
+      targets |= rook_attacks(from, occupied);
+    }
+    if (piece.type == Piece::BISHOP || piece.type == Piece::QUEEN) {
+      targets |= bishop_attacks(from, occupied);
+    }
+    _add_moves(moves, from, targets & allowed & legal);
+  }
+}
+
+void Game::get_moves(Player *player, MoveList &moves, MoveKind kind) {
+  STATS(ai::StatsTimer timer(ai::thread_stats.movegen_ticks));
+  moves.size = 0;
+  _Constraints constraints = _constraints(player->color);
+  for (Bitboard pieces = occupancy[player->color]; pieces;) {
+    _add_piece_moves(moves, pop_lsb(pieces), kind, constraints);
+  }
+}
+
+bool Game::is_legal(Player *player, Move move) {
+  if (!(occupancy[player->color] & bit(move.from()))) {
+    return false;
+  }
+  MoveList moves;
+  _add_piece_moves(moves, move.from(), ALL_MOVES,
+                   _constraints(player->color));
+  for (Move candidate : moves) {
+    if (candidate == move) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Game::_leaves_check(Move move, Color color, uint8_t captured) {
+  Color enemy = opponent(color);
+  Bitboard occupied =
+      ((occupancy[BLACK] | occupancy[WHITE]) ^ bit(move.from())) |
+      bit(move.to());
+  Bitboard remaining = ~(Bitboard)0;
+  if (captured != NO_SQUARE) {
+    remaining = ~bit(captured);
+    occupied &= remaining | bit(move.to());
+  }
+  uint8_t king = squares[move.from()] == (color << 3 | Piece::KING)
+                     ? move.to()
+                     : king_square(color);
+  Bitboard attackers = occupancy[enemy] & remaining;
+  return (PAWN_ATTACKS[color][king] & types[Piece::PAWN] & attackers) ||
+         (KNIGHT_ATTACKS[king] & types[Piece::KNIGHT] & attackers) ||
+         (KING_ATTACKS[king] & types[Piece::KING] & attackers) ||
+         (rook_attacks(king, occupied) & attackers &
+          (types[Piece::ROOK] | types[Piece::QUEEN])) ||
+         (bishop_attacks(king, occupied) & attackers &
+          (types[Piece::BISHOP] | types[Piece::QUEEN]));
+}
+
+bool Game::find_move(Player *player, uint8_t x1, uint8_t y1, uint8_t x2,
+                     uint8_t y2, Piece::Type promotion_type, Move &move) {
+  MoveList moves;
+  get_moves(player, moves);
+  for (Move candidate : moves) {
+    if (candidate.x1() == x1 && candidate.y1() == y1 &&
+        candidate.x2() == x2 && candidate.y2() == y2 &&
+        candidate.promotion_type() == promotion_type) {
+      move = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Game::parse_move(Player *player, const char *text, Move &move) {
+  if (strlen(text) < 4) {
+    return false;
+  }
+  uint8_t x1 = text[0] - 'a', y1 = '8' - text[1], x2 = text[2] - 'a',
+          y2 = '8' - text[3];
+  Piece::Type promotion_type = Piece::NONE;
+  switch (text[4]) {
+  case 'n':
+    promotion_type = Piece::KNIGHT;
+    break;
+  case 'b':
+    promotion_type = Piece::BISHOP;
+    break;
+  case 'r':
+    promotion_type = Piece::ROOK;
+    break;
+  case 'q':
+    promotion_type = Piece::QUEEN;
+    break;
+  }
+  return find_move(player, x1, y1, x2, y2, promotion_type, move);
+}
+
+bool Game::parse_san(Player *player, const char *san, Move &move) {
+  std::string text = san;
+  while (!text.empty() && strchr("+#!?", text.back())) {
+    text.pop_back();
+  }
+  Piece::Type type = Piece::PAWN, promotion_type = Piece::NONE;
+  int x1 = -1, y1 = -1, x2, y2;
+  if (text == "O-O" || text == "0-0" || text == "O-O-O" || text == "0-0-0") {
+    uint8_t king = king_square(player->color);
+    type = Piece::KING;
+    x2 = king % BOARD_SIZE + (text.size() == 3 ? 2 : -2);
+    y2 = king / BOARD_SIZE;
+  } else {
+    const char *types = " PNBRQK";
+    if (!text.empty() && strchr(types + 2, text[0])) {
+      type = (Piece::Type)(strchr(types, text[0]) - types);
+      text.erase(0, 1);
+    }
+    if (text.size() > 2 && strchr("NBRQnbrq", text.back())) {
+      promotion_type =
+          (Piece::Type)(strchr(types, toupper(text.back())) - types);
+      text.pop_back();
+      if (text.back() == '=') {
+        text.pop_back();
       }
     }
-    // king movement
-    else if (piece.type == Piece::KING) {
-      for (Delta delta : KING_DELTAS) {
-        uint8_t x = piece.x + delta.x;
-        uint8_t y = piece.y + delta.y;
-        if (x < BOARD_SIZE && y < BOARD_SIZE) {
-          if (!board[y][x]) {
-            moves.push_back(Move(&piece, x, y));
-          } else if (board[y][x]->color != player->color) {
-            moves.push_back(Move(&piece, x, y, board[y][x]));
-          }
-        }
+    if (text.size() < 2) {
+      return false;
+    }
+    x2 = text[text.size() - 2] - 'a';
+    y2 = '8' - text[text.size() - 1];
+    for (size_t i = 0; i + 2 < text.size(); i++) {
+      if (text[i] >= 'a' && text[i] <= 'h') {
+        x1 = text[i] - 'a';
+      } else if (text[i] >= '1' && text[i] <= '8') {
+        y1 = '8' - text[i];
+      } else if (text[i] != 'x') {
+        return false;
       }
-      // check for castling
-      if (!piece.has_moved && !is_check(player)) {
-        uint8_t y = piece.y;
-        if (board[y][0] && !board[y][0]->has_moved && !board[y][1] &&
-            !board[y][2] && !board[y][3]) {
-          moves.push_back(Move(&piece, 2, y));
-        }
-        if (board[y][7] && !board[y][7]->has_moved && !board[y][6] &&
-            !board[y][5]) {
-          moves.push_back(Move(&piece, 6, y));
-        }
+    }
+  }
+  MoveList moves;
+  get_moves(player, moves);
+  unsigned matches = 0;
+  for (Move candidate : moves) {
+    if (piece_at(candidate.from()).type == type && candidate.x2() == x2 &&
+        candidate.y2() == y2 && candidate.promotion_type() == promotion_type &&
+        (x1 < 0 || candidate.x1() == x1) && (y1 < 0 || candidate.y1() == y1)) {
+      move = candidate;
+      matches++;
+    }
+  }
+  return matches == 1;
+}
+
+std::string Game::get_san(Move move) {
+  Piece piece = piece_at(move.from());
+  std::string san;
+  if (piece.type == Piece::KING && std::abs(move.x2() - move.x1()) == 2) {
+    san = move.x2() > move.x1() ? "O-O" : "O-O-O";
+  } else {
+    bool capture = is_capture(move);
+    if (piece.type == Piece::PAWN) {
+      if (capture) {
+        san += 'a' + move.x1();
       }
     } else {
-      // horizontal/vertical sliding
-      if (piece.type == Piece::ROOK || piece.type == Piece::QUEEN) {
-        for (Delta delta : HORZ_VERT_DETLAS) {
-          for (uint8_t d = 1;; d++) {
-            uint8_t x = piece.x + d * delta.x;
-            uint8_t y = piece.y + d * delta.y;
-            if (x >= BOARD_SIZE || y >= BOARD_SIZE) {
-              break;
-            }
-            Piece *target = board[y][x];
-            if (target) {
-              if (target->color != player->color) {
-                moves.push_back(Move(&piece, x, y, target));
-              }
-              break;
-            }
-            moves.push_back(Move(&piece, x, y));
-          }
+      san += " PNBRQK"[piece.type];
+      // name the file, rank or both of the square moved from if another
+      // piece of the same type can move to the same square
+      Player *player = piece.color == WHITE ? &white : &black;
+      MoveList moves;
+      get_moves(player, moves);
+      bool ambiguous = false, same_file = false, same_rank = false;
+      for (Move other : moves) {
+        if (other.to() == move.to() && other.from() != move.from() &&
+            piece_at(other.from()).type == piece.type) {
+          ambiguous = true;
+          same_file |= other.x1() == move.x1();
+          same_rank |= other.y1() == move.y1();
         }
       }
-      // diagonal sliding
-      if (piece.type == Piece::BISHOP || piece.type == Piece::QUEEN) {
-        for (Delta delta : DIAGONAL_DELTAS) {
-          for (uint8_t d = 1;; d++) {
-            uint8_t x = piece.x + d * delta.x;
-            uint8_t y = piece.y + d * delta.y;
-            if (x >= BOARD_SIZE || y >= BOARD_SIZE) {
-              break;
-            }
-            Piece *target = board[y][x];
-            if (target) {
-              if (target->color != player->color) {
-                moves.push_back(Move(&piece, x, y, target));
-              }
-              break;
-            }
-            moves.push_back(Move(&piece, x, y));
-          }
-        }
+      if (ambiguous && (!same_file || same_rank)) {
+        san += 'a' + move.x1();
+      }
+      if (ambiguous && same_file) {
+        san += '8' - move.y1();
       }
     }
+    if (capture) {
+      san += 'x';
+    }
+    san += 'a' + move.x2();
+    san += '8' - move.y2();
+    if (move.promotion_type()) {
+      san += '=';
+      san += " PNBRQK"[move.promotion_type()];
+    }
+  }
+  // mark checks and mates
+  Player *opponent = piece.color == WHITE ? &black : &white;
+  make_move(move);
+  if (is_check(opponent)) {
+    san += get_state(opponent) == LOSS ? '#' : '+';
   }
-  return moves;
+  undo_move(move);
+  return san;
 }
 
-bool Game::make_move(Move &move) {
-  // apply move
-  if (move.captured) {
-    move.captured->is_live = false;
-  }
-  board[move.y1][move.x1] = nullptr;
-  board[move.y2][move.x2] = move.piece;
-  move.piece->x = move.x2;
-  move.piece->y = move.y2;
-  move.piece->has_moved = true;
-  // check for castling
-  if (move.piece->type == Piece::KING && !move.had_moved && move.x2 == 2) {
-    Piece *rook = board[move.y2][0];
-    rook->x = 3;
-    rook->has_moved = true;
-    board[move.y2][0] = nullptr;
-    board[move.y2][3] = rook;
-  }
-  if (move.piece->type == Piece::KING && !move.had_moved && move.x2 == 6) {
-    Piece *rook = board[move.y2][7];
-    rook->x = 5;
-    rook->has_moved = true;
-    board[move.y2][7] = nullptr;
-    board[move.y2][5] = rook;
-  }
-  // check for pawn promotion
-  if (move.promotion_type) {
-    move.piece->type = move.promotion_type;
+bool Game::is_capture(Move move) {
+  // en passant is a pawn capture onto an empty square
+  return squares[move.to()] ||
+         ((types[Piece::PAWN] & bit(move.from())) && move.x1() != move.x2());
+}
+
+void Game::make_move(Move move) {
+  STATS(ai::StatsTimer timer(ai::thread_stats.make_ticks));
+  uint8_t from = move.from(), to = move.to();
+  Piece piece = piece_at(from);
+  // en passant takes the pawn beside the moving one
+  uint8_t captured = squares[to] ? to : NO_SQUARE;
+  if (piece.type == Piece::PAWN && to == en_passant) {
+    captured = square(move.x2(), move.y1());
   }
-  // en passant setup
-  move.last_pawn_adv2 = last_pawn_adv2;
-  if (move.piece->type == Piece::PAWN &&
-      std::abs((int)move.y1 - move.y2) == 2) {
-    last_pawn_adv2 = move.piece;
+  Piece::Type captured_type =
+      captured != NO_SQUARE ? piece_at(captured).type : Piece::NONE;
+  if (copy_make) {
+    _positions.push_back(*this);
+    if (ai::network) {
+      _accumulators.push_back(accumulator);
+    }
   } else {
-    last_pawn_adv2 = nullptr;
+    _history.push_back({.hash = hash,
+                        .captured = captured_type,
+                        .castling = castling,
+                        .en_passant = en_passant,
+                        .halfmove_clock = halfmove_clock});
   }
-  // en passant capture
-  if (move.captured && move.y2 != move.captured->y) {
-    board[move.captured->y][move.captured->x] = nullptr;
+  hash ^= ZOBRIST_SIDE ^ ZOBRIST_CASTLING[castling];
+  if (en_passant != NO_SQUARE) {
+    hash ^= ZOBRIST_EN_PASSANT[en_passant % BOARD_SIZE];
   }
-  // make sure player isn't put in check
-  if (is_check(move.piece->color == BLACK ? &black : &white)) {
-    undo_move(move);
-    return false;
+  // apply move
+  if (captured_type) {
+    _toggle(opponent(piece.color), captured_type, captured);
   }
-  return true;
+  _toggle(piece.color, piece.type, from);
+  _toggle(piece.color,
+          move.promotion_type() ? move.promotion_type() : piece.type, to);
+  // check for castling
+  if (piece.type == Piece::KING && std::abs(move.x2() - move.x1()) == 2) {
+    uint8_t y = move.y2();
+    uint8_t rook_x1 = move.x2() == 2 ? 0 : 7, rook_x2 = move.x2() == 2 ? 3 : 5;
+    _toggle(piece.color, Piece::ROOK, square(rook_x1, y));
+    _toggle(piece.color, Piece::ROOK, square(rook_x2, y));
+  }
+  castling &= _CASTLING_MASKS.masks[from] & _CASTLING_MASKS.masks[to];
+  // en passant setup
+  en_passant = piece.type == Piece::PAWN && std::abs(move.y1() - move.y2()) == 2
+                   ? (from + to) / 2
+                   : NO_SQUARE;
+  hash ^= ZOBRIST_CASTLING[castling];
+  if (en_passant != NO_SQUARE) {
+    hash ^= ZOBRIST_EN_PASSANT[en_passant % BOARD_SIZE];
+  }
+  halfmove_clock =
+      captured_type || piece.type == Piece::PAWN ? 0 : halfmove_clock + 1;
+  fullmove_number += piece.color == BLACK;
+  turn = opponent(piece.color);
 }
 
-void Game::undo_move(Move &move) {
+void Game::undo_move(Move move) {
+  STATS(ai::StatsTimer timer(ai::thread_stats.make_ticks));
+  if (copy_make) {
+    Position &position = *this;
+    position = _positions.back();
+    _positions.pop_back();
+    if (ai::network) {
+      accumulator = _accumulators.back();
+      _accumulators.pop_back();
+    }
+    return;
+  }
+  uint8_t from = move.from(), to = move.to();
+  _Undo undo = _history.back();
+  _history.pop_back();
+  Color color = opponent(turn);
+  Piece::Type type = piece_at(to).type;
   // un-apply move
-  if (move.captured) {
-    move.captured->is_live = true;
+  _toggle(color, type, to);
+  if (move.promotion_type()) {
+    type = Piece::PAWN;
   }
-  board[move.y1][move.x1] = move.piece;
-  if (move.captured) {
-    board[move.y2][move.x2] = nullptr;
-    board[move.captured->y][move.captured->x] = move.captured;
-  } else {
-    board[move.y2][move.x2] = nullptr;
+  _toggle(color, type, from);
+  if (undo.captured) {
+    uint8_t captured = type == Piece::PAWN && to == undo.en_passant
+                           ? square(move.x2(), move.y1())
+                           : to;
+    _toggle(opponent(color), undo.captured, captured);
   }
-  move.piece->x = move.x1;
-  move.piece->y = move.y1;
-  move.piece->has_moved = move.had_moved;
   // check for castling
-  if (move.piece->type == Piece::KING && !move.had_moved && move.x2 == 2) {
-    Piece *rook = board[move.y2][3];
-    rook->x = 0;
-    rook->has_moved = false;
-    board[move.y2][3] = nullptr;
-    board[move.y2][0] = rook;
-  }
-  if (move.piece->type == Piece::KING && !move.had_moved && move.x2 == 6) {
-    Piece *rook = board[move.y2][5];
-    rook->x = 7;
-    rook->has_moved = false;
-    board[move.y2][5] = nullptr;
-    board[move.y2][7] = rook;
-  }
-  // check for pawn promotion
-  if (move.promotion_type) {
-    move.piece->type = Piece::PAWN;
+  if (type == Piece::KING && std::abs(move.x2() - move.x1()) == 2) {
+    uint8_t y = move.y2();
+    uint8_t rook_x1 = move.x2() == 2 ? 0 : 7, rook_x2 = move.x2() == 2 ? 3 : 5;
+    _toggle(color, Piece::ROOK, square(rook_x2, y));
+    _toggle(color, Piece::ROOK, square(rook_x1, y));
   }
-  // en passant setup
-  last_pawn_adv2 = move.last_pawn_adv2;
+  castling = undo.castling;
+  en_passant = undo.en_passant;
+  hash = undo.hash;
+  halfmove_clock = undo.halfmove_clock;
+  fullmove_number -= color == BLACK;
+  turn = color;
+}
+
+void Game::make_null_move() {
+  _history.push_back({.hash = hash,
+                      .captured = Piece::NONE,
+                      .castling = castling,
+                      .en_passant = en_passant,
+                      .halfmove_clock = halfmove_clock});
+  hash ^= ZOBRIST_SIDE;
+  halfmove_clock++;
+  fullmove_number += turn == BLACK;
+  turn = opponent(turn);
+  if (en_passant != NO_SQUARE) {
+    hash ^= ZOBRIST_EN_PASSANT[en_passant % BOARD_SIZE];
+  }
+  en_passant = NO_SQUARE;
+}
+
+void Game::undo_null_move() {
+  en_passant = _history.back().en_passant;
+  hash = _history.back().hash;
+  halfmove_clock = _history.back().halfmove_clock;
+  turn = opponent(turn);
+  fullmove_number -= turn == BLACK;
+  _history.pop_back();
 }
 
 Game::State Game::get_state(Player *player) {
-  for (Move &move : get_moves(player)) {
-    if (make_move(move)) {
-      undo_move(move);
-      return IN_PLAY;
-    }
-    undo_move(move);
+  MoveList moves;
+  get_moves(player, moves);
+  if (moves.size) {
+    return IN_PLAY;
   }
   if (is_check(player)) {
     return LOSS;
@@ -357,33 +749,38 @@ Game::State Game::get_state(Player *player) {
   }
 }
 
-// get the number of positions at a given depth, for testing purposes
-unsigned _get_poses(Game &game, Player *player, uint8_t depth) {
-  unsigned num_moves = 0;
-  for (Move &move : game.get_moves(player)) {
-    if (game.make_move(move)) {
-      if (depth > 1) {
-        num_moves += _get_poses(
-            game, player == &game.black ? &game.white : &game.black, depth - 1);
+void Game::test() {
+  // the start position, then positions with castling, en passant and
+  // promotions that the start position takes too long to reach
+  const struct {
+    const char *fen;
+    std::vector<uint64_t> expected_poses;
+  } positions[] = {
+      {START_FEN, {20, 400, 8902, 197281, 4865609, 119060324}},
+      {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+       {48, 2039, 97862, 4085603}},
+      {"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", {14, 191, 2812, 43238}},
+      {"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+       {6, 264, 9467, 422333}},
+      {"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+       {44, 1486, 62379, 2103487}},
+  };
+  for (auto &position : positions) {
+    if (!load_fen(position.fen) || get_fen() != position.fen) {
+      printf("Error: could not load %s\n", position.fen);
+      continue;
+    }
+    printf("Testing %s\n", position.fen);
+    for (uint8_t i = 0; i < position.expected_poses.size(); i++) {
+      printf("Testing depth %d ...\n", i + 1);
+      uint64_t poses = perft(*this, i + 1);
+      if (poses == position.expected_poses[i]) {
+        printf("Correct!\n");
       } else {
-        num_moves++;
+        printf("Error: expected %llu, got %llu\n",
+               (unsigned long long)position.expected_poses[i],
+               (unsigned long long)poses);
       }
-      game.undo_move(move);
-    }
-  }
-  return num_moves;
-}
-
-void Game::test() {
-  std::vector<unsigned> expected_poses{20,     400,     8902,
-                                       197281, 4865609, 119060324};
-  for (uint8_t i = 0; i < expected_poses.size(); i++) {
-    printf("Testing depth %d ...\n", i + 1);
-    unsigned poses = _get_poses(*this, &white, i + 1);
-    if (poses == expected_poses[i]) {
-      printf("Correct!\n");
-    } else {
-      printf("Error: expected %u, got %u\n", expected_poses[i], poses);
     }
   }
 }
@@ -1,23 +1,30 @@
+#include "bitboard.hpp"
 #include <stdint.h>
+#include <string>
 #include <tuple>
+#include <type_traits>
 #include <vector>
 #pragma once
 
 namespace chess {
 
 #define BOARD_SIZE 8
-#define NUM_PIECES_PER_SIDE 16
+// an en passant square when there is none
+#define NO_SQUARE 64
+
+// the standard starting position in Forsyth-Edwards notation
+#define START_FEN "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
 
 class Game;
 
-enum Color { BLACK, WHITE };
+enum Color : uint8_t { BLACK, WHITE };
+
+inline Color opponent(Color color) { return color == BLACK ? WHITE : BLACK; }
 
 struct Piece {
+  enum Type : uint8_t { NONE, PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING };
   Color color;
-  enum Type { NONE, PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING } type;
-  uint8_t x, y;
-  bool is_live = true;
-  bool has_moved = false;
+  Type type;
 };
 
 struct Delta {
@@ -45,44 +52,216 @@ struct Delta {
             {-1, -1},
 };
 
+// random keys xor'd together to hash a position, by piece, castling rights
+// and en passant file, and flipped each move for the side to move
+extern uint64_t ZOBRIST_PIECES[2][Piece::KING + 1][64], ZOBRIST_CASTLING[16],
+    ZOBRIST_EN_PASSANT[BOARD_SIZE], ZOBRIST_SIDE;
+
+// a rating for the middlegame and one for the endgame, blended by the phase of
+// the game
+struct Score {
+  int mg, eg;
+};
+
+// the material and placement score of a piece on each square, by color and
+// type, and how much each type counts towards the phase, which starts at
+// `MAX_PHASE` and falls as pieces are taken
+extern Score PIECE_SQUARE_SCORES[2][Piece::KING + 1][64];
+extern const int PHASE_WEIGHTS[Piece::KING + 1];
+#define MAX_PHASE 24
+
+// size of the hidden layer of the evaluation network
+#define NNUE_HIDDEN 256
+
+// the hidden layer of the evaluation network before activation, from each
+// color's point of view, indexed by color
+struct alignas(32) Accumulator {
+  int16_t values[2][NNUE_HIDDEN];
+};
+
+// a move packed into 16 bits as `from | to << 6 | promotion_type << 12`, with
+// squares indexed by `y * 8 + x`; castling is a king move of two squares and
+// en passant a pawn capture onto an empty square
 struct Move {
-  uint8_t x1, y1, x2, y2;
-  bool had_moved;
-  Piece *piece;
-  Piece *captured;
-  Piece::Type promotion_type;
-  Piece *last_pawn_adv2;
-  Move(Piece *piece, uint8_t x, uint8_t y, Piece *captured = nullptr,
-       Piece::Type promotion_type = Piece::NONE)
-      : x1(piece->x), y1(piece->y), x2(x), y2(y), had_moved(piece->has_moved),
-        piece(piece), captured(captured), promotion_type(promotion_type) {}
+  uint16_t data;
+  Move() = default;
+  Move(uint8_t from, uint8_t to, Piece::Type promotion_type = Piece::NONE)
+      : data(from | to << 6 | promotion_type << 12) {}
+  uint8_t from() const { return data & 63; }
+  uint8_t to() const { return (data >> 6) & 63; }
+  uint8_t x1() const { return from() % BOARD_SIZE; }
+  uint8_t y1() const { return from() / BOARD_SIZE; }
+  uint8_t x2() const { return to() % BOARD_SIZE; }
+  uint8_t y2() const { return to() / BOARD_SIZE; }
+  Piece::Type promotion_type() const { return (Piece::Type)(data >> 12); }
+  bool operator==(Move other) const { return data == other.data; }
+  bool operator!=(Move other) const { return data != other.data; }
+  // write the move in the form `parse_move` reads, such as `e2e4` or `e7e8q`,
+  // to a buffer of at least 6 characters
+  void to_text(char *text) const;
+};
+
+#define MAX_MOVES 256
+// deepest a search can go from the position it starts at
+#define MAX_PLY 64
+
+// a fixed-capacity list of moves, kept on the stack so generating moves
+// never allocates
+struct MoveList {
+  Move moves[MAX_MOVES];
+  unsigned size = 0;
+  void push(Move move) { moves[size++] = move; }
+  Move &operator[](unsigned i) { return moves[i]; }
+  Move *begin() { return moves; }
+  Move *end() { return moves + size; }
 };
 
+// which moves to generate: captures also include promotions and en passant,
+// and quiets everything else
+enum MoveKind { ALL_MOVES, CAPTURES, QUIETS };
+
 struct Player {
   Color color;
-  std::vector<Piece> pieces;
-  Piece *king;
-  Player() : pieces(NUM_PIECES_PER_SIDE) {}
 };
 
-class Game {
+// castling rights, as kept in `Position::castling`
+enum CastlingRights : uint8_t {
+  BLACK_QUEENSIDE = 1,
+  BLACK_KINGSIDE = 2,
+  WHITE_QUEENSIDE = 4,
+  WHITE_KINGSIDE = 8,
+};
+
+// everything about a position, without pointers so it can be copied as plain
+// bytes; a search can save and restore it whole rather than undoing a move
+struct Position {
+  // occupancy of each piece type of both colors, indexed by type, and of each
+  // color
+  Bitboard types[Piece::KING + 1], occupancy[2];
+  // zobrist hash of the position, including the side to move, castling
+  // rights and en passant target
+  uint64_t hash;
+  // sum of the piece-square scores of each side
+  Score psqt[2];
+  // the piece on each square as `color << 3 | type`, or 0 if empty
+  uint8_t squares[64];
+  Color turn;
+  uint8_t castling;
+  // the square a pawn that just moved two squares passed over, or
+  // `NO_SQUARE`
+  uint8_t en_passant;
+  // the phase of the game, which starts at `MAX_PHASE` and falls as pieces
+  // are taken
+  uint8_t phase;
+  // the number of moves since the last capture or pawn move, and the number
+  // of the move being played, starting at 1 and counted up after each black
+  // move
+  uint16_t halfmove_clock, fullmove_number;
+
+  Bitboard pieces(Color color, Piece::Type type) const {
+    return types[type] & occupancy[color];
+  }
+  Piece piece_at(uint8_t square) const {
+    return {(Color)(squares[square] >> 3),
+            (Piece::Type)(squares[square] & 7)};
+  }
+  uint8_t king_square(Color color) const {
+    return lsb(pieces(color, Piece::KING));
+  }
+};
+static_assert(std::is_trivially_copyable<Position>::value,
+              "positions are copied as plain bytes");
+static_assert(sizeof(Position) <= 192, "positions should stay small");
+
+class Game : public Position {
 public:
   enum State { IN_PLAY, LOSS, DRAW };
-  Piece *board[BOARD_SIZE][BOARD_SIZE], *last_pawn_adv2 = nullptr;
   Player black, white;
+  // kept up to date only while a network is loaded
+  Accumulator accumulator;
+  // undo moves by copying back the position from before the move instead of
+  // reversing the move's changes
+  bool copy_make = false;
   Game();
-  // determines if the piece can be taken in a move
+  // set up a position from Forsyth-Edwards notation, returning false and
+  // leaving the game as it was if the notation isn't valid
+  bool load_fen(const char *fen);
+  // get the position in Forsyth-Edwards notation
+  std::string get_fen();
+  // determines if a square is attacked by the given color
+  bool is_attacked(uint8_t square, Color attacker);
+  // determines if the player's king can be taken in a move
   bool is_check(Player *player);
-  // get all possible moves for the active player
-  std::vector<Move> get_moves(Player *player);
-  // apply a move, returning true if successful
-  bool make_move(Move &move);
-  // undo a move
-  void undo_move(Move &move);
+  // get all legal moves of a kind for the active player
+  void get_moves(Player *player, MoveList &moves, MoveKind kind = ALL_MOVES);
+  // determines if a move, such as one from another position, is one of the
+  // player's legal moves
+  bool is_legal(Player *player, Move move);
+  // find a player's move between two squares, returning true if it is one of
+  // the player's moves
+  bool find_move(Player *player, uint8_t x1, uint8_t y1, uint8_t x2, uint8_t y2,
+                 Piece::Type promotion_type, Move &move);
+  // find a player's move from coordinate notation such as `e2e4` or `e7e8q`,
+  // returning true if it is one of the player's moves
+  bool parse_move(Player *player, const char *text, Move &move);
+  // find a player's move from standard algebraic notation such as `Nbd7`,
+  // `exd8=Q+` or `O-O`, returning true if exactly one of their moves matches
+  bool parse_san(Player *player, const char *san, Move &move);
+  // write a legal move in standard algebraic notation, before it is made
+  std::string get_san(Move move);
+  // determines if a move takes a piece, before it is made
+  bool is_capture(Move move);
+  // apply a legal move
+  void make_move(Move move);
+  // undo the last move made
+  void undo_move(Move move);
+  // pass the turn without moving, which the player mustn't be in check for
+  void make_null_move();
+  // undo the last null move made
+  void undo_null_move();
   // check the state of the game for a given player
   State get_state(Player *player);
   // test the chess engine
   void test();
+
+private:
+  // what a move changed that can't be recovered from the move itself
+  struct _Undo {
+    uint64_t hash;
+    Piece::Type captured;
+    uint8_t castling, en_passant;
+    uint16_t halfmove_clock;
+  };
+  std::vector<_Undo> _history;
+  // with `copy_make`, the positions and accumulators from before each move
+  std::vector<Position> _positions;
+  std::vector<Accumulator> _accumulators;
+
+  // what limits the moves of the player to move, found once per position:
+  // the king's square, the squares any other piece must move to in order to
+  // block or take a checking piece, and the pieces pinned to the king
+  struct _Constraints {
+    uint8_t king;
+    bool in_check;
+    Bitboard check_mask, pinned;
+  };
+  _Constraints _constraints(Color color);
+  // determines if a square is attacked by the given color with the given
+  // squares occupied
+  bool _is_attacked(uint8_t square, Color attacker, Bitboard occupied);
+  // determines if a move would leave the moving player in check, without
+  // applying it, where `captured` is the square of the piece it takes or
+  // `NO_SQUARE`
+  bool _leaves_check(Move move, Color color, uint8_t captured);
+  // compute the hash from scratch
+  uint64_t _compute_hash();
+  // add or remove a piece from the bitboards, squares, hash and scores
+  void _toggle(Color color, Piece::Type type, uint8_t square);
+  // add a move for each target square of a piece
+  void _add_moves(MoveList &moves, uint8_t from, Bitboard targets);
+  // add the legal moves of a kind for the piece on a square
+  void _add_piece_moves(MoveList &moves, uint8_t from, MoveKind kind,
+                        const _Constraints &constraints);
 };
 
 } // namespace chess
@@ -0,0 +1,174 @@
+#include "eval.hpp"
+#include "nnue.hpp"
+#include "stats.hpp"
+
+using namespace chess;
+using namespace ai;
+
+Score chess::PIECE_SQUARE_SCORES[2][Piece::KING + 1][64];
+const int chess::PHASE_WEIGHTS[Piece::KING + 1] = {0, 0, 1, 1, 2, 4, 0};
+Evaluator ai::evaluator = HAND_WRITTEN;
+bool ai::use_mobility = true;
+
+// the value of each piece type in the middlegame and endgame
+const Score _MATERIAL[Piece::KING + 1] = {
+    {0, 0}, {100, 120}, {320, 300}, {330, 320}, {500, 520}, {900, 950}, {0, 0},
+};
+
+// bonuses for the placement of each piece type in the middlegame, from white's
+// side with the eighth rank first
+const int _MIDGAME_PLACEMENT[Piece::KING + 1][64] = {
+    {},
+    {
+        0,  0,  0,   0,   0,   0,   0,  0,  //
+        50, 50, 50,  50,  50,  50,  50, 50, //
+        10, 10, 20,  30,  30,  20,  10, 10, //
+        5,  5,  10,  25,  25,  10,  5,  5,  //
+        0,  0,  0,   20,  20,  0,   0,  0,  //
+        5,  -5, -10, 0,   0,   -10, -5, 5,  //
+        5,  10, 10,  -20, -20, 10,  10, 5,  //
+        0,  0,  0,   0,   0,   0,   0,  0,  //
+    },
+    {
+        -50, -40, -30, -30, -30, -30, -40, -50, //
+        -40, -20, 0,   0,   0,   0,   -20, -40, //
+        -30, 0,   10,  15,  15,  10,  0,   -30, //
+        -30, 5,   15,  20,  20,  15,  5,   -30, //
+        -30, 0,   15,  20,  20,  15,  0,   -30, //
+        -30, 5,   10,  15,  15,  10,  5,   -30, //
+        -40, -20, 0,   5,   5,   0,   -20, -40, //
+        -50, -40, -30, -30, -30, -30, -40, -50, //
+    },
+    {
+        -20, -10, -10, -10, -10, -10, -10, -20, //
+        -10, 0,   0,   0,   0,   0,   0,   -10, //
+        -10, 0,   5,   10,  10,  5,   0,   -10, //
+        -10, 5,   5,   10,  10,  5,   5,   -10, //
+        -10, 0,   10,  10,  10,  10,  0,   -10, //
+        -10, 10,  10,  10,  10,  10,  10,  -10, //
+        -10, 5,   0,   0,   0,   0,   5,   -10, //
+        -20, -10, -10, -10, -10, -10, -10, -20, //
+    },
+    {
+        0,  0,  0,  0,  0,  0,  0,  0,  //
+        5,  10, 10, 10, 10, 10, 10, 5,  //
+        -5, 0,  0,  0,  0,  0,  0,  -5, //
+        -5, 0,  0,  0,  0,  0,  0,  -5, //
+        -5, 0,  0,  0,  0,  0,  0,  -5, //
+        -5, 0,  0,  0,  0,  0,  0,  -5, //
+        -5, 0,  0,  0,  0,  0,  0,  -5, //
+        0,  0,  0,  5,  5,  0,  0,  0,  //
+    },
+    {
+        -20, -10, -10, -5, -5, -10, -10, -20, //
+        -10, 0,   0,   0,  0,  0,   0,   -10, //
+        -10, 0,   5,   5,  5,  5,   0,   -10, //
+        -5,  0,   5,   5,  5,  5,   0,   -5,  //
+        0,   0,   5,   5,  5,  5,   0,   -5,  //
+        -10, 5,   5,   5,  5,  5,   0,   -10, //
+        -10, 0,   5,   0,  0,  0,   0,   -10, //
+        -20, -10, -10, -5, -5, -10, -10, -20, //
+    },
+    {
+        -30, -40, -40, -50, -50, -40, -40, -30, //
+        -30, -40, -40, -50, -50, -40, -40, -30, //
+        -30, -40, -40, -50, -50, -40, -40, -30, //
+        -30, -40, -40, -50, -50, -40, -40, -30, //
+        -20, -30, -30, -40, -40, -30, -30, -20, //
+        -10, -20, -20, -20, -20, -20, -20, -10, //
+        20,  20,  0,   0,   0,   0,   20,  20,  //
+        20,  30,  10,  0,   0,   10,  30,  20,  //
+    },
+};
+
+// in the endgame, pawns are worth more the closer they are to promoting and
+// the king belongs in the center; other pieces are placed as in the
+// middlegame
+const int _PAWN_ENDGAME_PLACEMENT[64] = {
+    0,  0,  0,  0,  0,  0,  0,  0,  //
+    80, 80, 80, 80, 80, 80, 80, 80, //
+    50, 50, 50, 50, 50, 50, 50, 50, //
+    30, 30, 30, 30, 30, 30, 30, 30, //
+    15, 15, 15, 15, 15, 15, 15, 15, //
+    5,  5,  5,  5,  5,  5,  5,  5,  //
+    0,  0,  0,  0,  0,  0,  0,  0,  //
+    0,  0,  0,  0,  0,  0,  0,  0,  //
+},
+          _KING_ENDGAME_PLACEMENT[64] = {
+              -50, -40, -30, -20, -20, -30, -40, -50, //
+              -30, -20, -10, 0,   0,   -10, -20, -30, //
+              -30, -10, 20,  30,  30,  20,  -10, -30, //
+              -30, -10, 30,  40,  40,  30,  -10, -30, //
+              -30, -10, 30,  40,  40,  30,  -10, -30, //
+              -30, -10, 20,  30,  30,  20,  -10, -30, //
+              -30, -30, 0,   0,   0,   0,   -30, -30, //
+              -50, -30, -30, -30, -30, -30, -30, -50, //
+};
+
+// bonus per square each piece type can move to, in the middlegame and endgame
+const Score _MOBILITY[Piece::KING + 1] = {
+    {0, 0}, {0, 0}, {4, 4}, {5, 5}, {2, 4}, {1, 2}, {0, 0},
+};
+
+// fill the piece-square scores before any game is created
+static struct _PieceSquareScores {
+  _PieceSquareScores() {
+    for (uint8_t type = Piece::PAWN; type <= Piece::KING; type++) {
+      const int *endgame = type == Piece::PAWN   ? _PAWN_ENDGAME_PLACEMENT
+                           : type == Piece::KING ? _KING_ENDGAME_PLACEMENT
+                                                 : _MIDGAME_PLACEMENT[type];
+      for (uint8_t sq = 0; sq < 64; sq++) {
+        // the tables are from white's side, whose back rank is the last row,
+        // so black's are mirrored vertically
+        for (Color color : {BLACK, WHITE}) {
+          uint8_t index = color == WHITE ? sq : sq ^ 56;
+          PIECE_SQUARE_SCORES[color][type][sq] = {
+              _MATERIAL[type].mg + _MIDGAME_PLACEMENT[type][index],
+              _MATERIAL[type].eg + endgame[index],
+          };
+        }
+      }
+    }
+  }
+} _piece_square_scores;
+
+// get the mobility score of one side
+Score _mobility(Game &game, Color color) {
+  Bitboard occupied = game.occupancy[BLACK] | game.occupancy[WHITE],
+           targets = ~game.occupancy[color];
+  Score score = {0, 0};
+  for (uint8_t type = Piece::KNIGHT; type <= Piece::QUEEN; type++) {
+    for (Bitboard remaining = game.pieces(color, (Piece::Type)type);
+         remaining;) {
+      uint8_t from = pop_lsb(remaining);
+      Bitboard attacks = type == Piece::KNIGHT ? KNIGHT_ATTACKS[from]
+                         : type == Piece::BISHOP
+                             ? bishop_attacks(from, occupied)
+                         : type == Piece::ROOK ? rook_attacks(from, occupied)
+                                               : queen_attacks(from, occupied);
+      unsigned moves = popcount(attacks & targets);
+      score.mg += moves * _MOBILITY[type].mg;
+      score.eg += moves * _MOBILITY[type].eg;
+    }
+  }
+  return score;
+}
+
+int ai::evaluate(Game &game, Player *player) {
+  STATS(StatsTimer timer(thread_stats.eval_ticks));
+  if (evaluator == NEURAL_NETWORK && network) {
+    return network->evaluate(game.accumulator, player->color);
+  }
+  // blend the middlegame and endgame scores by the phase of the game
+  Color color = player->color, enemy = opponent(color);
+  Score score = {game.psqt[color].mg - game.psqt[enemy].mg,
+                 game.psqt[color].eg - game.psqt[enemy].eg};
+  if (use_mobility) {
+    Score own = _mobility(game, color), other = _mobility(game, enemy);
+    score.mg += own.mg - other.mg;
+    score.eg += own.eg - other.eg;
+  }
+  // promotions can push the phase past its starting value
+  int phase = std::min((int)game.phase, MAX_PHASE);
+  return (score.mg * phase + score.eg * (MAX_PHASE - phase)) / MAX_PHASE;
+}
@@ -0,0 +1,18 @@
+#include "chess.hpp"
+#pragma once
+
+namespace ai {
+
+// how positions are rated: by hand-written piece-square tables and mobility,
+// or by the loaded network, falling back to the tables if there is none
+enum Evaluator { HAND_WRITTEN, NEURAL_NETWORK };
+extern Evaluator evaluator;
+
+// add how many squares each knight, bishop, rook and queen can move to onto
+// the piece-square scores
+extern bool use_mobility;
+
+// rate a position from a player's point of view, in hundredths of a pawn
+int evaluate(chess::Game &game, chess::Player *player);
+
+} // namespace ai
@@ -1,5 +1,15 @@
 #include "ai.hpp"
+#include "batch.hpp"
+#include "bench.hpp"
+#include "book.hpp"
 #include "chess.hpp"
+#include "eval.hpp"
+#include "nnue.hpp"
+#include "perft.hpp"
+#include "syzygy.hpp"
+#include "uci.hpp"
+#include <chrono>
+#include <memory>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,15 +24,15 @@ void draw_board(Game &game, Player *player) {
   for (uint8_t y = 0; y < BOARD_SIZE; y++) {
     printf("%d|", player->color == BLACK ? y + 1 : BOARD_SIZE - y);
     for (uint8_t x = 0; x < BOARD_SIZE; x++) {
-      Piece *piece =
-          game.board[player->color == BLACK ? BOARD_SIZE - y - 1 : y]
-                    [player->color == BLACK ? BOARD_SIZE - x - 1 : x];
-      if (piece) {
+      Piece piece = game.piece_at(
+          square(player->color == BLACK ? BOARD_SIZE - x - 1 : x,
+                 player->color == BLACK ? BOARD_SIZE - y - 1 : y));
+      if (piece.type) {
         const char *symbols[] = {
             "♙", "♘", "♗", "♖", "♕", "♔", "♟︎", "♞", "♝", "♜", "♛", "♚",
         };
         printf("%s ",
-               symbols[(piece->type - 1) + (piece->color == BLACK ? 0 : 6)]);
+               symbols[(piece.type - 1) + (piece.color == BLACK ? 0 : 6)]);
       } else {
         printf("%s ", (x + y) % 2 ? "·" : "•");
       }
@@ -34,25 +44,261 @@ void draw_board(Game &game, Player *player) {
 
 int main(int argc, char **argv) {
   Game game;
-  Player *player = &game.white;
 
   if (argc > 1 && !strcmp("test", argv[1])) {
     game.test();
+    if (!book::test()) {
+      return 1;
+    }
+    // the tables aren't shipped, so they're only checked when given, as
+    // `make test-syzygy` does after fetching them
+    if (argc > 2) {
+      syzygy::init(argv[2]);
+      return syzygy::test() ? 0 : 1;
+    }
+    return 0;
+  }
+  if (argc > 1 && !strcmp("uci", argv[1])) {
+    uci::loop();
+    return 0;
+  }
+  if (argc > 2 && !strcmp("perft", argv[1])) {
+    bool divide = false;
+    unsigned threads = 1;
+    size_t hash_mb = 0;
+    bool copy_make = false;
+    for (int i = 3; i < argc; i++) {
+      if (!strcmp("divide", argv[i])) {
+        divide = true;
+      } else if (!strcmp("threads", argv[i]) && i + 1 < argc) {
+        threads = atoi(argv[++i]);
+      } else if (!strcmp("hash", argv[i]) && i + 1 < argc) {
+        hash_mb = atoi(argv[++i]);
+      } else if (!strcmp("copymake", argv[i])) {
+        copy_make = true;
+      } else if (!game.load_fen(argv[i])) {
+        printf("Invalid FEN %s\n", argv[i]);
+        return 1;
+      }
+    }
+    game.copy_make = copy_make;
+    std::unique_ptr<PerftTable> table;
+    if (hash_mb) {
+      table.reset(new PerftTable(hash_mb));
+    }
+    run_perft(game, atoi(argv[2]), threads, table.get(), divide);
+    return 0;
+  }
+  if (argc > 1 && !strcmp("bench", argv[1])) {
+    unsigned depth = 10;
+    bool json = false;
+    for (int i = 2; i < argc; i++) {
+      if (!strcmp("json", argv[i])) {
+        json = true;
+      } else {
+        depth = atoi(argv[i]);
+      }
+    }
+    bench::search_suite(depth, json);
+    return 0;
+  }
+  if (argc > 1 && !strcmp("make", argv[1])) {
+    bench::make_speed(argc > 2 ? atoi(argv[2]) : 4);
     return 0;
   }
-  bool bongcloud = argc > 1 && !strcmp("bongcloud", argv[1]);
+  if (argc > 1 && !strcmp("stats", argv[1])) {
+    unsigned depth = 8;
+    const char *trace_path = nullptr;
+    for (int i = 2; i < argc; i++) {
+      if (!strcmp("trace", argv[i]) && i + 1 < argc) {
+        trace_path = argv[++i];
+      } else {
+        depth = atoi(argv[i]);
+      }
+    }
+    bench::search_stats(depth, trace_path);
+    return 0;
+  }
+  if (argc > 1 && !strcmp("micro", argv[1])) {
+    const char *baseline_path = nullptr, *save_path = nullptr;
+    for (int i = 2; i + 1 < argc; i += 2) {
+      if (!strcmp("baseline", argv[i])) {
+        baseline_path = argv[i + 1];
+      } else if (!strcmp("save", argv[i])) {
+        save_path = argv[i + 1];
+      }
+    }
+    return bench::micro(baseline_path, save_path) ? 0 : 1;
+  }
+  if (argc > 1 && !strcmp("smp", argv[1])) {
+    bench::time_to_depth(argc > 2 ? atoi(argv[2]) : 5);
+    return 0;
+  }
+  if (argc > 1 && !strcmp("eval", argv[1])) {
+    if (argc > 2 && !load_network(argv[2])) {
+      printf("Could not load network from %s\n", argv[2]);
+      return 1;
+    }
+    bench::eval_speed();
+    return 0;
+  }
+  if (argc > 2 &&
+      (!strcmp("selfplay", argv[1]) || !strcmp("analyse", argv[1]))) {
+    batch::Options options;
+    options.analyse = !strcmp("analyse", argv[1]);
+    for (int i = 3; i + 1 < argc; i += 2) {
+      if (!strcmp("rounds", argv[i])) {
+        options.rounds = atoi(argv[i + 1]);
+      } else if (!strcmp("concurrency", argv[i])) {
+        options.concurrency = atoi(argv[i + 1]);
+      } else if (!strcmp("hash", argv[i])) {
+        options.hash_mb = std::max(atoi(argv[i + 1]), 1);
+      } else if (!strcmp("maxplies", argv[i])) {
+        options.max_plies = atoi(argv[i + 1]);
+      } else if (!strcmp("depth", argv[i])) {
+        options.limits.depth = atoi(argv[i + 1]);
+      } else if (!strcmp("nodes", argv[i])) {
+        options.limits.nodes = atoll(argv[i + 1]);
+      } else if (!strcmp("movetime", argv[i])) {
+        options.limits.movetime = atoi(argv[i + 1]);
+      } else if (!strcmp("pgn", argv[i])) {
+        options.pgn_path = argv[i + 1];
+      } else if (!strcmp("jsonl", argv[i])) {
+        options.jsonl_path = argv[i + 1];
+      } else {
+        printf("Unknown option %s\n", argv[i]);
+        return 1;
+      }
+    }
+    if (!batch::run(argv[2], options)) {
+      printf("Could not open %s or an output file\n", argv[2]);
+      return 1;
+    }
+    return 0;
+  }
+  if (argc > 3 && !strcmp("probe", argv[1])) {
+    printf("Found %u tablebases\n", syzygy::init(argv[2]));
+    if (!game.load_fen(argv[3])) {
+      printf("Invalid FEN %s\n", argv[3]);
+      return 1;
+    }
+    syzygy::WDL wdl;
+    int dtz;
+    if (!syzygy::probe_wdl(game, wdl)) {
+      printf("Position not found\n");
+      return 1;
+    }
+    const char *results[] = {"loss",       "blessed loss", "draw",
+                             "cursed win", "win"};
+    printf("WDL: %s\n", results[wdl - syzygy::LOSS]);
+    if (syzygy::probe_dtz(game, dtz)) {
+      printf("DTZ: %d\n", dtz);
+    }
+    MoveList moves;
+    game.get_moves(game.turn == WHITE ? &game.white : &game.black, moves);
+    if (syzygy::filter_root_moves(game, moves)) {
+      printf("Best moves:");
+      for (Move move : moves) {
+        char text[6];
+        move.to_text(text);
+        printf(" %s", text);
+      }
+      printf("\n");
+    }
+    return 0;
+  }
+  if (argc > 4 && !strcmp("book", argv[1]) && !strcmp("build", argv[2])) {
+    if (!book::build(argv[3], argv[4], argc > 5 ? atoi(argv[5]) : 20)) {
+      printf("Could not build a book from %s to %s\n", argv[3], argv[4]);
+      return 1;
+    }
+    return 0;
+  }
+  if (argc > 2 && !strcmp("book", argv[1])) {
+    if (!book::open(argv[2])) {
+      printf("Could not open book %s\n", argv[2]);
+      return 1;
+    }
+    if (argc > 3 && !game.load_fen(argv[3])) {
+      printf("Invalid FEN %s\n", argv[3]);
+      return 1;
+    }
+    MoveList moves;
+    uint16_t weights[MAX_MOVES];
+    auto start = std::chrono::steady_clock::now();
+    unsigned count = book::find(game, moves, weights);
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+    for (unsigned i = 0; i < count; i++) {
+      char text[6];
+      moves[i].to_text(text);
+      printf("%-6s %u\n", text, weights[i]);
+    }
+    printf("Found %u moves in %lld ns\n", count, (long long)elapsed);
+    return 0;
+  }
+  bool bongcloud = false;
+  Limits limits;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp("bongcloud", argv[i])) {
+      bongcloud = true;
+    } else if (!strcmp("threads", argv[i]) && i + 1 < argc) {
+      num_threads = atoi(argv[++i]);
+    } else if (!strcmp("movetime", argv[i]) && i + 1 < argc) {
+      limits.movetime = atoi(argv[++i]);
+    } else if (!strcmp("split", argv[i])) {
+      search_mode = ROOT_SPLIT;
+    } else if (!strcmp("ybw", argv[i])) {
+      search_mode = ROOT_SPLIT;
+      split_replies = true;
+    } else if (!strcmp("nonull", argv[i])) {
+      null_move_pruning = false;
+    } else if (!strcmp("nolmr", argv[i])) {
+      late_move_reductions = false;
+    } else if (!strcmp("nofutility", argv[i])) {
+      futility_pruning = false;
+    } else if (!strcmp("nomobility", argv[i])) {
+      use_mobility = false;
+    } else if (!strcmp("copymake", argv[i])) {
+      game.copy_make = true;
+    } else if (!strcmp("book", argv[i]) && i + 1 < argc) {
+      if (!book::open(argv[++i])) {
+        printf("Could not open book %s\n", argv[i]);
+        return 1;
+      }
+    } else if (!strcmp("syzygy", argv[i]) && i + 1 < argc) {
+      syzygy::init(argv[++i]);
+    } else if (!strcmp("fen", argv[i]) && i + 1 < argc) {
+      if (!game.load_fen(argv[++i])) {
+        printf("Invalid FEN %s\n", argv[i]);
+        return 1;
+      }
+    } else if (!strcmp("nnue", argv[i]) && i + 1 < argc) {
+      if (!load_network(argv[++i])) {
+        printf("Could not load network from %s\n", argv[i]);
+        return 1;
+      }
+      network->refresh(game);
+      evaluator = NEURAL_NETWORK;
+    }
+  }
 
-  // get player's color
+  // get player's color, or switch to UCI if a GUI started the engine
 get_color:
   printf("Enter team (`b` or `w`): ");
-  char color_input;
-  if (scanf(" %c", &color_input) != 1 ||
-      (color_input != 'b' && color_input != 'w')) {
+  char color_input[8];
+  if (scanf(" %7s", color_input) == 1 && !strcmp("uci", color_input)) {
+    uci::loop(true);
+    return 0;
+  }
+  if (strcmp("b", color_input) && strcmp("w", color_input)) {
     printf("Invalid color\n");
     goto get_color;
   }
-  Player *human = color_input == 'b' ? &game.black : &game.white;
+  Player *human = color_input[0] == 'b' ? &game.black : &game.white;
   Player *ai = human == &game.black ? &game.white : &game.black;
+  Player *player = game.turn == WHITE ? &game.white : &game.black;
 
   // game loop
   draw_board(game, human);
@@ -77,26 +323,45 @@ get_color:
       if (bongcloud && ai_move_counter <= 2) {
         Move move =
             player->color == chess::BLACK
-                ? (ai_move_counter == 1 ? Move(&player->pieces[12], 4, 3)
-                                        : Move(player->king, 4, 1))
-                : (ai_move_counter == 1 ? Move(&player->pieces[12], 4, 4)
-                                        : Move(player->king, 4, 6));
-        if (game.make_move(move)) {
+                ? (ai_move_counter == 1 ? Move(square(4, 1), square(4, 3))
+                                        : Move(square(4, 0), square(4, 1)))
+                : (ai_move_counter == 1 ? Move(square(4, 6), square(4, 4))
+                                        : Move(square(4, 7), square(4, 6)));
+        if (game.find_move(player, move.x1(), move.y1(), move.x2(),
+                           move.y2(), Piece::NONE, move)) {
+          game.make_move(move);
           draw_board(game, human);
           player = human;
           continue;
         }
       }
-      MoveChoice move_choice = best_move(game, ai);
+      Move book_move;
+      if (book::probe(game, book_move)) {
+        game.make_move(book_move);
+        draw_board(game, human);
+        char text[6];
+        book_move.to_text(text);
+        printf("AI's move: %s (book)\n", text);
+        player = human;
+        continue;
+      }
+      MoveChoice move_choice = best_move(game, ai, limits);
       Move move = move_choice.move;
       game.make_move(move);
       draw_board(game, human);
-      printf("AI's move: %c%d to %c%d (%d.%d -> %d.%d)\n", 'a' + move.x1,
-             BOARD_SIZE - move.y1, 'a' + move.x2, BOARD_SIZE - move.y2,
+      printf("AI's move: %c%d to %c%d (%d.%d -> %d.%d)\n", 'a' + move.x1(),
+             BOARD_SIZE - move.y1(), 'a' + move.x2(), BOARD_SIZE - move.y2(),
              move_choice.current_rating / 100,
              std::abs(move_choice.current_rating % 100),
              move_choice.target_rating / 100,
              std::abs(move_choice.target_rating % 100));
+      printf("Depth %u, %llu nodes, %llu nps, %u ms, pv ", move_choice.depth,
+             (unsigned long long)move_choice.nodes,
+             (unsigned long long)(move_choice.nodes * 1000 /
+                                  std::max(move_choice.elapsed, 1u)),
+             move_choice.elapsed);
+      print_line(move_choice.pv);
+      printf("\n");
       player = human;
       continue;
     }
@@ -113,15 +378,15 @@ get_color:
     y1 = BOARD_SIZE - (y1 - '1') - 1;
     x2 -= 'a';
     y2 = BOARD_SIZE - (y2 - '1') - 1;
-    if (x1 > BOARD_SIZE || y1 > BOARD_SIZE || x2 > BOARD_SIZE ||
-        y2 > BOARD_SIZE) {
+    if (x1 >= BOARD_SIZE || y1 >= BOARD_SIZE || x2 >= BOARD_SIZE ||
+        y2 >= BOARD_SIZE) {
       printf("Invalid square, must be between `a1` and `h8`\n");
       goto get_move;
     }
 
     // check if the move is a pawn promotion
     Piece::Type promotion_type = Piece::NONE;
-    if (game.board[y1][x1] && game.board[y1][x1]->type == Piece::PAWN &&
+    if (game.piece_at(square(x1, y1)).type == Piece::PAWN &&
         (y2 == 0 || y2 == 7)) {
     get_promotion:;
       char promotion_input;
@@ -149,24 +414,17 @@ get_color:
     }
 
     // ensure that move is reachable
-    Piece *piece = game.board[y1][x1];
-    if (!piece || piece->color != human->color) {
+    Piece piece = game.piece_at(square(x1, y1));
+    if (!piece.type || piece.color != human->color) {
       printf("Invalid piece selected\n");
       goto get_move;
     }
-    for (Move &move : game.get_moves(human)) {
-      if (piece == move.piece && x2 == move.x2 && y2 == move.y2 &&
-          promotion_type == move.promotion_type) {
-        if (!game.make_move(move)) {
-          printf("Invalid move: resulted in check\n");
-          goto get_move;
-        }
-        goto found;
-      }
+    Move move;
+    if (!game.find_move(human, x1, y1, x2, y2, promotion_type, move)) {
+      printf("Invalid move: invalid target square or leaves king in check\n");
+      goto get_move;
     }
-    printf("Invalid move: invalid target square\n");
-    goto get_move;
-  found:
+    game.make_move(move);
     // switch turns and start over
     draw_board(game, human);
     player = ai;
@@ -0,0 +1,184 @@
+#include "move_picker.hpp"
+
+using namespace chess;
+using namespace ai;
+
+// the value of each piece type, in hundredths of a pawn, with the king
+// worth more than everything else together
+const int _PIECE_VALUES[] = {0, 100, 300, 300, 500, 900, 10000};
+
+int ai::capture_gain(Game &game, Move move) {
+  Piece victim = game.piece_at(move.to());
+  int gain = 0;
+  if (victim.type) {
+    gain = _PIECE_VALUES[victim.type];
+  }
+  // an en passant capture lands on an empty square
+  else if (move.x1() != move.x2() &&
+           game.piece_at(move.from()).type == Piece::PAWN) {
+    gain = _PIECE_VALUES[Piece::PAWN];
+  }
+  if (move.promotion_type()) {
+    gain += _PIECE_VALUES[move.promotion_type()] - _PIECE_VALUES[Piece::PAWN];
+  }
+  return gain;
+}
+
+// get the pieces of both colors attacking a square through the given
+// occupancy
+Bitboard _attackers(Game &game, uint8_t to, Bitboard occupied) {
+  Bitboard *types = game.types;
+  Bitboard rooks = types[Piece::ROOK] | types[Piece::QUEEN],
+           bishops = types[Piece::BISHOP] | types[Piece::QUEEN];
+  return ((PAWN_ATTACKS[WHITE][to] & game.pieces(BLACK, Piece::PAWN)) |
+          (PAWN_ATTACKS[BLACK][to] & game.pieces(WHITE, Piece::PAWN)) |
+          (KNIGHT_ATTACKS[to] & types[Piece::KNIGHT]) |
+          (KING_ATTACKS[to] & types[Piece::KING]) |
+          (rook_attacks(to, occupied) & rooks) |
+          (bishop_attacks(to, occupied) & bishops)) &
+         occupied;
+}
+
+int ai::see(Game &game, Move move) {
+  uint8_t to = move.to();
+  Piece attacker = game.piece_at(move.from());
+  Bitboard occupied =
+      (game.occupancy[BLACK] | game.occupancy[WHITE]) ^ bit(move.from());
+  if (!game.squares[move.to()] && move.x1() != move.x2() &&
+      attacker.type == Piece::PAWN) {
+    occupied ^= bit(square(move.x2(), move.y1()));
+  }
+  // the gain of each capture in the sequence if it were the last
+  int gains[32];
+  unsigned depth = 0;
+  gains[0] = capture_gain(game, move);
+  Piece::Type on_square =
+      move.promotion_type() ? move.promotion_type() : attacker.type;
+  Color side = opponent(attacker.color);
+  for (;;) {
+    Bitboard attackers = _attackers(game, to, occupied);
+    Bitboard own = attackers & game.occupancy[side];
+    if (!own) {
+      break;
+    }
+    // recapture with the least valuable piece
+    uint8_t type = Piece::PAWN;
+    while (!(own & game.types[type])) {
+      type++;
+    }
+    // a king can't recapture onto a defended square
+    if (type == Piece::KING && (attackers & game.occupancy[opponent(side)])) {
+      break;
+    }
+    depth++;
+    gains[depth] = _PIECE_VALUES[on_square] - gains[depth - 1];
+    occupied ^= bit(lsb(own & game.types[type]));
+    on_square = (Piece::Type)type;
+    side = opponent(side);
+  }
+  // unwind the sequence, each side stopping when recapturing would lose
+  for (; depth > 0; depth--) {
+    gains[depth - 1] = -std::max(-gains[depth - 1], gains[depth]);
+  }
+  return gains[0];
+}
+
+void MoveHistory::update(Color color, Move move, unsigned ply,
+                         unsigned depth) {
+  if (ply < MAX_PLY && killers[ply][0] != move) {
+    killers[ply][1] = killers[ply][0];
+    killers[ply][0] = move;
+  }
+  history[color][move.from()][move.to()] += depth * depth;
+}
+
+MovePicker::MovePicker(Game &game, Player *player, Move tt_move,
+                       MoveHistory &history, unsigned ply, bool captures_only)
+    : _game(game), _player(player), _tt_move(tt_move),
+      _captures_only(captures_only), _history(history) {
+  _killers[0] = ply < MAX_PLY ? history.killers[ply][0] : Move();
+  _killers[1] = ply < MAX_PLY ? history.killers[ply][1] : Move();
+}
+
+Move MovePicker::_pick_best() {
+  unsigned best = _index;
+  for (unsigned i = _index + 1; i < _moves.size; i++) {
+    if (_scores[i] > _scores[best]) {
+      best = i;
+    }
+  }
+  std::swap(_moves[_index], _moves[best]);
+  std::swap(_scores[_index], _scores[best]);
+  return _moves[_index++];
+}
+
+bool MovePicker::_tried(Move move) {
+  return move == _tt_move ||
+         (_stage == QUIETS && (move == _killers[0] || move == _killers[1]));
+}
+
+bool MovePicker::next(Move &move) {
+  switch (_stage) {
+  case TT_MOVE:
+    _stage = GENERATE_CAPTURES;
+    if (_tt_move.data && _game.is_legal(_player, _tt_move)) {
+      move = _tt_move;
+      return true;
+    }
+    [[fallthrough]];
+  case GENERATE_CAPTURES:
+    _game.get_moves(_player, _moves, chess::CAPTURES);
+    for (unsigned i = 0; i < _moves.size; i++) {
+      _scores[i] = capture_gain(_game, _moves[i]) -
+                   _game.piece_at(_moves[i].from()).type;
+    }
+    _index = 0;
+    _stage = CAPTURES;
+    [[fallthrough]];
+  case CAPTURES:
+    while (_index < _moves.size) {
+      move = _pick_best();
+      if (!_tried(move)) {
+        return true;
+      }
+    }
+    if (_captures_only) {
+      _stage = DONE;
+      return false;
+    }
+    _index = 0;
+    _stage = KILLERS;
+    [[fallthrough]];
+  case KILLERS:
+    while (_index < 2) {
+      move = _killers[_index++];
+      if (move.data && !_tried(move) && _game.is_legal(_player, move) &&
+          !_game.is_capture(move)) {
+        return true;
+      }
+    }
+    _stage = GENERATE_QUIETS;
+    [[fallthrough]];
+  case GENERATE_QUIETS:
+    _game.get_moves(_player, _moves, chess::QUIETS);
+    for (unsigned i = 0; i < _moves.size; i++) {
+      _scores[i] =
+          _history.history[_player->color][_moves[i].from()][_moves[i].to()];
+    }
+    _index = 0;
+    _stage = QUIETS;
+    [[fallthrough]];
+  case QUIETS:
+    while (_index < _moves.size) {
+      move = _pick_best();
+      if (!_tried(move)) {
+        return true;
+      }
+    }
+    _stage = DONE;
+    [[fallthrough]];
+  case DONE:
+    return false;
+  }
+  return false;
+}
@@ -0,0 +1,63 @@
+#include "chess.hpp"
+#pragma once
+
+namespace ai {
+
+// the material a capture or promotion gains before any recapture
+int capture_gain(chess::Game &game, chess::Move move);
+// static exchange evaluation: the material a capture wins once every piece
+// attacking its square has recaptured, least valuable first, where either
+// side may stop recapturing when it would lose material
+int see(chess::Game &game, chess::Move move);
+
+// what a search thread learns about quiet moves as it searches: the moves that
+// last caused a cutoff at each ply, and how often each move has by its squares
+struct MoveHistory {
+  chess::Move killers[MAX_PLY][2];
+  int history[2][64][64];
+
+  // record a quiet move that caused a cutoff
+  void update(chess::Color color, chess::Move move, unsigned ply,
+              unsigned depth);
+};
+
+// hands out the moves of a position one at a time in the order most likely to
+// cause a cutoff: the table's move, captures by most valuable victim and least
+// valuable attacker, killer moves, and then quiet moves by their history; each
+// stage is only generated once the one before it runs out, so a cutoff skips
+// the rest; a quiescence search only takes the captures
+class MovePicker {
+public:
+  MovePicker(chess::Game &game, chess::Player *player, chess::Move tt_move,
+             MoveHistory &history, unsigned ply, bool captures_only = false);
+  // get the next move to try, which is always legal since the table's move
+  // and killers are checked and the rest are generated legal, returning false
+  // once every move has been tried
+  bool next(chess::Move &move);
+
+private:
+  enum _Stage {
+    TT_MOVE,
+    GENERATE_CAPTURES,
+    CAPTURES,
+    KILLERS,
+    GENERATE_QUIETS,
+    QUIETS,
+    DONE
+  } _stage = TT_MOVE;
+  chess::Game &_game;
+  chess::Player *_player;
+  chess::Move _tt_move, _killers[2];
+  bool _captures_only;
+  MoveHistory &_history;
+  chess::MoveList _moves;
+  int _scores[MAX_MOVES];
+  unsigned _index = 0;
+
+  // move the best scored of the moves left to the front and return it
+  chess::Move _pick_best();
+  // determines if a move was already tried in an earlier stage
+  bool _tried(chess::Move move);
+};
+
+} // namespace ai
@@ -0,0 +1,229 @@
+#include "nnue.hpp"
+#include <stdio.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+using namespace chess;
+using namespace ai;
+
+Network *ai::network = nullptr;
+NnueKernel ai::nnue_kernel = SCALAR;
+
+// the hidden layer's activations are clipped to `[0, NNUE_QA]`, and the
+// output weights scaled by `NNUE_QB`; the output is then scaled to hundredths
+// of a pawn by `NNUE_SCALE`
+#define NNUE_QA 255
+#define NNUE_QB 64
+#define NNUE_SCALE 400
+
+// identifies a network file, followed by its number of features and hidden
+// size, and then its weights in the order they're declared, little endian
+const char _MAGIC[4] = {'M', 'C', 'N', 'N'};
+
+bool ai::kernel_supported(NnueKernel kernel) {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  switch (kernel) {
+  case AVX2:
+    return __builtin_cpu_supports("avx2");
+  case SSE41:
+    return __builtin_cpu_supports("sse4.1");
+  default:
+    return true;
+  }
+#else
+  return kernel == SCALAR;
+#endif
+}
+
+// pick the widest kernel before any network is loaded
+static struct _KernelChoice {
+  _KernelChoice() {
+    for (NnueKernel kernel : {AVX2, SSE41, SCALAR}) {
+      if (kernel_supported(kernel)) {
+        nnue_kernel = kernel;
+        break;
+      }
+    }
+  }
+} _kernel_choice;
+
+// get the input for a piece on a square from a color's point of view, with
+// its own pieces first and the board flipped for black so both colors see
+// their pieces from their own side
+unsigned _feature(Color perspective, Color color, Piece::Type type,
+                  uint8_t square) {
+  return ((color != perspective) * 6 + type - 1) * 64 +
+         (perspective == WHITE ? square : square ^ 56);
+}
+
+// add or subtract a row of weights from a hidden layer
+void _update_scalar(int16_t *values, const int16_t *weights, int sign) {
+  for (unsigned i = 0; i < NNUE_HIDDEN; i++) {
+    values[i] += sign * weights[i];
+  }
+}
+
+// sum the clipped activations of a hidden layer times their output weights
+int32_t _output_scalar(const int16_t *values, const int16_t *weights) {
+  int32_t sum = 0;
+  for (unsigned i = 0; i < NNUE_HIDDEN; i++) {
+    sum += std::min(std::max((int)values[i], 0), NNUE_QA) * weights[i];
+  }
+  return sum;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.1"))) void
+_update_sse41(int16_t *values, const int16_t *weights, int sign) {
+  for (unsigned i = 0; i < NNUE_HIDDEN; i += 8) {
+    __m128i value = _mm_loadu_si128((__m128i *)&values[i]),
+            weight = _mm_loadu_si128((const __m128i *)&weights[i]);
+    value = sign > 0 ? _mm_add_epi16(value, weight)
+                     : _mm_sub_epi16(value, weight);
+    _mm_storeu_si128((__m128i *)&values[i], value);
+  }
+}
+
+__attribute__((target("sse4.1"))) int32_t
+_output_sse41(const int16_t *values, const int16_t *weights) {
+  __m128i zero = _mm_setzero_si128(), max = _mm_set1_epi16(NNUE_QA),
+          sum = _mm_setzero_si128();
+  for (unsigned i = 0; i < NNUE_HIDDEN; i += 8) {
+    __m128i value = _mm_loadu_si128((const __m128i *)&values[i]),
+            weight = _mm_loadu_si128((const __m128i *)&weights[i]);
+    value = _mm_min_epi16(_mm_max_epi16(value, zero), max);
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(value, weight));
+  }
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0b01001110));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0b10110001));
+  return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("avx2"))) void
+_update_avx2(int16_t *values, const int16_t *weights, int sign) {
+  for (unsigned i = 0; i < NNUE_HIDDEN; i += 16) {
+    __m256i value = _mm256_loadu_si256((__m256i *)&values[i]),
+            weight = _mm256_loadu_si256((const __m256i *)&weights[i]);
+    value = sign > 0 ? _mm256_add_epi16(value, weight)
+                     : _mm256_sub_epi16(value, weight);
+    _mm256_storeu_si256((__m256i *)&values[i], value);
+  }
+}
+
+__attribute__((target("avx2"))) int32_t
+_output_avx2(const int16_t *values, const int16_t *weights) {
+  __m256i zero = _mm256_setzero_si256(), max = _mm256_set1_epi16(NNUE_QA),
+          sum = _mm256_setzero_si256();
+  for (unsigned i = 0; i < NNUE_HIDDEN; i += 16) {
+    __m256i value = _mm256_loadu_si256((const __m256i *)&values[i]),
+            weight = _mm256_loadu_si256((const __m256i *)&weights[i]);
+    value = _mm256_min_epi16(_mm256_max_epi16(value, zero), max);
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(value, weight));
+  }
+  __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum),
+                               _mm256_extracti128_si256(sum, 1));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0b01001110));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0b10110001));
+  return _mm_cvtsi128_si32(half);
+}
+#endif
+
+void _update(int16_t *values, const int16_t *weights, int sign) {
+  switch (nnue_kernel) {
+#if defined(__x86_64__)
+  case AVX2:
+    return _update_avx2(values, weights, sign);
+  case SSE41:
+    return _update_sse41(values, weights, sign);
+#endif
+  default:
+    return _update_scalar(values, weights, sign);
+  }
+}
+
+int32_t _output(const int16_t *values, const int16_t *weights) {
+  switch (nnue_kernel) {
+#if defined(__x86_64__)
+  case AVX2:
+    return _output_avx2(values, weights);
+  case SSE41:
+    return _output_sse41(values, weights);
+#endif
+  default:
+    return _output_scalar(values, weights);
+  }
+}
+
+bool Network::load(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    return false;
+  }
+  char magic[4];
+  uint32_t num_features, hidden_size;
+  int8_t output_weights[2 * NNUE_HIDDEN];
+  bool loaded =
+      fread(magic, sizeof(magic), 1, file) == 1 &&
+      !memcmp(magic, _MAGIC, sizeof(magic)) &&
+      fread(&num_features, sizeof(num_features), 1, file) == 1 &&
+      num_features == NNUE_FEATURES &&
+      fread(&hidden_size, sizeof(hidden_size), 1, file) == 1 &&
+      hidden_size == NNUE_HIDDEN &&
+      fread(_feature_weights, sizeof(_feature_weights), 1, file) == 1 &&
+      fread(_feature_biases, sizeof(_feature_biases), 1, file) == 1 &&
+      fread(output_weights, sizeof(output_weights), 1, file) == 1 &&
+      fread(&_output_bias, sizeof(_output_bias), 1, file) == 1 &&
+      fgetc(file) == EOF;
+  fclose(file);
+  for (unsigned i = 0; i < 2 * NNUE_HIDDEN; i++) {
+    _output_weights[i] = output_weights[i];
+  }
+  return loaded;
+}
+
+void Network::update(Accumulator &accumulator, Color color, Piece::Type type,
+                     uint8_t square, int sign) const {
+  for (Color perspective : {BLACK, WHITE}) {
+    _update(accumulator.values[perspective],
+            _feature_weights[_feature(perspective, color, type, square)],
+            sign);
+  }
+}
+
+void Network::refresh(Game &game) const {
+  for (Color perspective : {BLACK, WHITE}) {
+    memcpy(game.accumulator.values[perspective], _feature_biases,
+           sizeof(_feature_biases));
+  }
+  for (Color color : {BLACK, WHITE}) {
+    for (uint8_t type = Piece::PAWN; type <= Piece::KING; type++) {
+      for (Bitboard pieces = game.pieces(color, (Piece::Type)type); pieces;) {
+        update(game.accumulator, color, (Piece::Type)type, pop_lsb(pieces),
+               1);
+      }
+    }
+  }
+}
+
+int Network::evaluate(const Accumulator &accumulator, Color color) const {
+  int64_t output =
+      _output(accumulator.values[color], _output_weights) +
+      _output(accumulator.values[opponent(color)],
+              _output_weights + NNUE_HIDDEN) +
+      _output_bias;
+  return output * NNUE_SCALE / (NNUE_QA * NNUE_QB);
+}
+
+bool ai::load_network(const char *path) {
+  Network *loaded = new Network;
+  if (!loaded->load(path)) {
+    delete loaded;
+    return false;
+  }
+  delete network;
+  network = loaded;
+  return true;
+}
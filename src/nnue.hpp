@@ -0,0 +1,52 @@
+#include "chess.hpp"
+#pragma once
+
+namespace ai {
+
+// number of inputs to the evaluation network: one per color, piece type and
+// square, relative to the color whose point of view it is
+#define NNUE_FEATURES 768
+
+// the instructions used to run the network, picked once at startup from what
+// the CPU supports
+enum NnueKernel { SCALAR, SSE41, AVX2 };
+extern NnueKernel nnue_kernel;
+// determines if the CPU can run a kernel
+bool kernel_supported(NnueKernel kernel);
+
+// an efficiently updatable neural network: a hidden layer from each color's
+// point of view, kept in every game's accumulator as pieces are added and
+// removed, then a clipped relu and a single output from the side to move's
+// point of view; the weights are quantized to 16 bits in the hidden layer and
+// 8 bits in the output
+class Network {
+public:
+  // read the weights from a file, returning false if it can't be read or is
+  // not a network of this shape
+  bool load(const char *path);
+  // add (`sign` of 1) or remove (-1) a piece's features from an accumulator
+  void update(chess::Accumulator &accumulator, chess::Color color,
+              chess::Piece::Type type, uint8_t square, int sign) const;
+  // recompute a game's accumulator from the pieces on its board
+  void refresh(chess::Game &game) const;
+  // rate a position from a color's point of view, in hundredths of a pawn
+  int evaluate(const chess::Accumulator &accumulator,
+               chess::Color color) const;
+
+private:
+  alignas(32) int16_t _feature_weights[NNUE_FEATURES][NNUE_HIDDEN];
+  alignas(32) int16_t _feature_biases[NNUE_HIDDEN];
+  // the weights of the side to move's hidden layer and then the other's,
+  // widened from 8 bits when loaded
+  alignas(32) int16_t _output_weights[2 * NNUE_HIDDEN];
+  int32_t _output_bias;
+};
+
+// the network used to rate positions, or null if none is loaded
+extern Network *network;
+
+// load a network from a file for every game created from now on, returning
+// false and keeping the current network if it can't be loaded
+bool load_network(const char *path);
+
+} // namespace ai
@@ -0,0 +1,116 @@
+#include "perft.hpp"
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <thread>
+
+using namespace chess;
+
+// layout of an entry's data word, which leaves 56 bits for the count
+#define DEPTH_BITS 8
+#define DEPTH_MASK ((1 << DEPTH_BITS) - 1)
+
+PerftTable::PerftTable(size_t mb) {
+  _num_entries = 1;
+  while (_num_entries * 2 * sizeof(_Entry) <= mb << 20) {
+    _num_entries *= 2;
+  }
+  _entries = new _Entry[_num_entries];
+  for (size_t i = 0; i < _num_entries; i++) {
+    _entries[i].check.store(0, std::memory_order_relaxed);
+    _entries[i].data.store(0, std::memory_order_relaxed);
+  }
+}
+
+PerftTable::~PerftTable() { delete[] _entries; }
+
+bool PerftTable::probe(uint64_t key, unsigned depth, uint64_t &count) {
+  _Entry &entry = _entries[key & (_num_entries - 1)];
+  uint64_t data = entry.data.load(std::memory_order_relaxed);
+  if ((entry.check.load(std::memory_order_relaxed) ^ data) != key ||
+      (data & DEPTH_MASK) != depth) {
+    return false;
+  }
+  count = data >> DEPTH_BITS;
+  return true;
+}
+
+void PerftTable::store(uint64_t key, unsigned depth, uint64_t count) {
+  _Entry &entry = _entries[key & (_num_entries - 1)];
+  uint64_t data = count << DEPTH_BITS | depth;
+  entry.check.store(key ^ data, std::memory_order_relaxed);
+  entry.data.store(data, std::memory_order_relaxed);
+}
+
+uint64_t chess::perft(Game &game, unsigned depth, PerftTable *table) {
+  if (depth == 0) {
+    return 1;
+  }
+  uint64_t count = 0;
+  // the counts of the last ply are too cheap to be worth storing
+  if (table && depth > 1 && table->probe(game.hash, depth, count)) {
+    return count;
+  }
+  Player *player = game.turn == WHITE ? &game.white : &game.black;
+  MoveList moves;
+  game.get_moves(player, moves);
+  // every move is legal, so the last ply is just the number of moves
+  if (depth == 1) {
+    return moves.size;
+  }
+  for (Move move : moves) {
+    game.make_move(move);
+    count += perft(game, depth - 1, table);
+    game.undo_move(move);
+  }
+  if (table) {
+    table->store(game.hash, depth, count);
+  }
+  return count;
+}
+
+uint64_t chess::run_perft(Game &game, unsigned depth, unsigned num_threads,
+                          PerftTable *table, bool divide) {
+  auto start = std::chrono::steady_clock::now();
+  Player *player = game.turn == WHITE ? &game.white : &game.black;
+  MoveList moves;
+  game.get_moves(player, moves);
+  // each thread takes the next move no thread has started on its own copy of
+  // the game, since a game can only be searched by one thread
+  uint64_t counts[MAX_MOVES] = {};
+  std::atomic<unsigned> next_move{0};
+  auto work = [&](Game &copy) {
+    for (unsigned i; depth && (i = next_move++) < moves.size;) {
+      copy.make_move(moves[i]);
+      counts[i] = perft(copy, depth - 1, table);
+      copy.undo_move(moves[i]);
+    }
+  };
+  num_threads = std::max(num_threads, 1u);
+  std::vector<Game> games(num_threads - 1, game);
+  std::vector<std::thread> threads;
+  for (Game &copy : games) {
+    threads.emplace_back(work, std::ref(copy));
+  }
+  work(game);
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  uint64_t total = depth == 0;
+  for (unsigned i = 0; i < moves.size; i++) {
+    if (divide) {
+      char text[6];
+      moves[i].to_text(text);
+      printf("%s: %llu\n", text, (unsigned long long)counts[i]);
+    }
+    total += counts[i];
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  printf("Nodes: %llu\n", (unsigned long long)total);
+  printf("Time: %.0f ms, %.0f nodes per second\n", seconds * 1000,
+         total / std::max(seconds, 1e-9));
+  return total;
+}
@@ -0,0 +1,39 @@
+#include "chess.hpp"
+#include <atomic>
+#pragma once
+
+namespace chess {
+
+// a fixed-size hash table of perft counts by position and depth, shared by
+// every perft thread; like the transposition table, each entry is stored
+// without locks as two words, the key xor'd with the data, so a torn write is
+// detected as a miss
+class PerftTable {
+public:
+  // allocate the largest power of two of entries that fits in `mb` megabytes
+  PerftTable(size_t mb);
+  ~PerftTable();
+  // find the count of a position at a depth, returning true if it's stored
+  bool probe(uint64_t key, unsigned depth, uint64_t &count);
+  void store(uint64_t key, unsigned depth, uint64_t count);
+
+private:
+  struct _Entry {
+    std::atomic<uint64_t> check, data;
+  };
+  _Entry *_entries;
+  size_t _num_entries;
+};
+
+// count the positions reached by every sequence of `depth` legal moves from
+// the game's position, looking up and storing subtree counts in `table` if
+// one is given
+uint64_t perft(Game &game, unsigned depth, PerftTable *table = nullptr);
+
+// count the positions below each legal move of the game, sharing the moves
+// between threads, printing each move's count if `divide` is set and then the
+// total with the leaf nodes counted per second
+uint64_t run_perft(Game &game, unsigned depth, unsigned num_threads,
+                   PerftTable *table, bool divide);
+
+} // namespace chess
@@ -0,0 +1,155 @@
+#include "stats.hpp"
+#include <algorithm>
+#include <stdio.h>
+#include <string>
+#include <thread>
+
+using namespace ai;
+
+thread_local SearchStats ai::thread_stats = {};
+
+double ai::stats_tick_ns() {
+  static const double tick_ns = [] {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t start_ticks = stats_ticks();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    uint64_t ticks = stats_ticks() - start_ticks;
+    return std::chrono::duration<double, std::nano>(
+               std::chrono::steady_clock::now() - start)
+               .count() /
+           std::max<uint64_t>(ticks, 1);
+  }();
+  return tick_ns;
+}
+
+void SearchStats::add(const SearchStats &other) {
+  tt_probes += other.tt_probes;
+  tt_hits += other.tt_hits;
+  for (unsigned ply = 0; ply < MAX_PLY; ply++) {
+    ply_nodes[ply] += other.ply_nodes[ply];
+  }
+  movegen_ticks += other.movegen_ticks;
+  make_ticks += other.make_ticks;
+  eval_ticks += other.eval_ticks;
+}
+
+// the open trace, when it was opened, and whether an event has been written
+// yet; then the depth of the last iteration traced, and in microseconds when
+// its search started and when it ended, so the next iteration starts where it
+// ended unless it's from a new search
+FILE *_trace = nullptr;
+std::chrono::steady_clock::time_point _trace_start;
+bool _trace_empty;
+unsigned _trace_depth;
+uint64_t _trace_first, _trace_last;
+
+// microseconds since the trace was opened
+uint64_t _trace_now() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - _trace_start)
+      .count();
+}
+
+// the counts of a search so far, as the arguments of an event
+std::string _trace_args(const MoveChoice &choice) {
+  char args[512];
+  const SearchStats &stats = choice.stats;
+  snprintf(args, sizeof(args),
+           "\"depth\": %u, \"rating\": %d, \"nodes\": %llu, \"qnodes\": %llu, "
+           "\"tb_hits\": %llu, \"tt_probes\": %llu, \"tt_hits\": %llu, "
+           "\"cutoffs\": %llu, \"first_move_cutoffs\": %llu, "
+           "\"movegen_ms\": %.3f, \"make_ms\": %.3f, \"eval_ms\": %.3f",
+           choice.depth, choice.target_rating,
+           (unsigned long long)choice.nodes, (unsigned long long)choice.qnodes,
+           (unsigned long long)choice.tb_hits,
+           (unsigned long long)stats.tt_probes,
+           (unsigned long long)stats.tt_hits,
+           (unsigned long long)choice.prunes.cutoffs,
+           (unsigned long long)choice.prunes.first_move_cutoffs,
+           stats.movegen_ticks * stats_tick_ns() / 1e6,
+           stats.make_ticks * stats_tick_ns() / 1e6,
+           stats.eval_ticks * stats_tick_ns() / 1e6);
+  std::string text = args;
+  text += ", \"pv\": \"";
+  for (unsigned i = 0; i < choice.pv.length; i++) {
+    char move[6];
+    choice.pv.moves[i].to_text(move);
+    text += (i ? " " : "") + std::string(move);
+  }
+  return text + "\"";
+}
+
+// write a complete event, from `start` to now in microseconds
+void _trace_event(const std::string &name, uint64_t start,
+                  const std::string &args) {
+  uint64_t now = _trace_now();
+  start = std::min(start, now);
+  fprintf(_trace,
+          "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, "
+          "\"ts\": %llu, \"dur\": %llu, \"args\": {%s}}",
+          _trace_empty ? "" : ",\n", name.c_str(), (unsigned long long)start,
+          (unsigned long long)(now - start), args.c_str());
+  _trace_empty = false;
+}
+
+bool ai::open_trace(const char *path) {
+  close_trace();
+  if (!(_trace = fopen(path, "w"))) {
+    return false;
+  }
+  fprintf(_trace, "[\n");
+  // measure the clock now, rather than in the middle of a search
+  stats_tick_ns();
+  _trace_start = std::chrono::steady_clock::now();
+  _trace_empty = true;
+  _trace_depth = 0;
+  return true;
+}
+
+void ai::trace_iteration(const MoveChoice &choice) {
+  if (!_trace) {
+    return;
+  }
+  uint64_t now = _trace_now();
+  if (choice.depth <= _trace_depth) {
+    _trace_depth = 0;
+  }
+  if (!_trace_depth) {
+    _trace_first = now - std::min<uint64_t>(now, choice.elapsed * 1000ull);
+  }
+  uint64_t start = _trace_depth ? _trace_last : _trace_first;
+  _trace_event("depth " + std::to_string(choice.depth), start,
+               _trace_args(choice));
+  _trace_depth = choice.depth;
+  _trace_last = now;
+}
+
+void ai::trace_search(const char *name, const MoveChoice &choice) {
+  if (!_trace) {
+    return;
+  }
+  uint64_t now = _trace_now();
+  std::string args = _trace_args(choice) + ", \"ply_nodes\": [";
+  unsigned plies = MAX_PLY;
+  while (plies && !choice.stats.ply_nodes[plies - 1]) {
+    plies--;
+  }
+  for (unsigned ply = 0; ply < plies; ply++) {
+    args += (ply ? ", " : "") + std::to_string(choice.stats.ply_nodes[ply]);
+  }
+  // the search's milliseconds are rounded down, so it may seem to start after
+  // its first iteration
+  uint64_t start = now - std::min<uint64_t>(now, choice.elapsed * 1000ull);
+  _trace_event(name, _trace_depth ? std::min(start, _trace_first) : start,
+               args + "]");
+  _trace_depth = 0;
+  fflush(_trace);
+}
+
+void ai::close_trace() {
+  if (_trace) {
+    fprintf(_trace, "\n]\n");
+    fclose(_trace);
+    _trace = nullptr;
+  }
+}
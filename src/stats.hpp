@@ -0,0 +1,58 @@
+#include "ai.hpp"
+#include <chrono>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+#pragma once
+
+// builds with `SEARCH_STATS` defined (`make STATS=1`) count what each search
+// does in its `SearchStats`; otherwise the counting compiles away
+#ifdef SEARCH_STATS
+#define STATS(statement) statement
+#else
+#define STATS(statement)
+#endif
+
+namespace ai {
+
+// counts of the search running on this thread that haven't been added to the
+// search's totals yet, kept per thread so the move generator and evaluation
+// can count without knowing which search called them
+extern thread_local SearchStats thread_stats;
+
+// a clock cheap enough to time the small, frequent steps of a search: the
+// CPU's time stamp counter where there is one, and nanoseconds otherwise
+inline uint64_t stats_ticks() {
+#if defined(__x86_64__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+// nanoseconds per tick of `stats_ticks`, measured the first time it's asked
+double stats_tick_ns();
+
+// adds the ticks between its creation and destruction to a count
+class StatsTimer {
+public:
+  StatsTimer(uint64_t &count) : _count(count), _start(stats_ticks()) {}
+  ~StatsTimer() { _count += stats_ticks() - _start; }
+
+private:
+  uint64_t &_count;
+  uint64_t _start;
+};
+
+// write the iterations of searches as a Chrome trace, which chrome://tracing
+// and Perfetto show as a timeline, each iteration an event with the search's
+// counts so far; searches of one game at a time only
+bool open_trace(const char *path);
+// add an iteration, as reported to `on_iteration`, to the open trace
+void trace_iteration(const MoveChoice &choice);
+// add a finished search, enclosing its iterations, to the open trace
+void trace_search(const char *name, const MoveChoice &choice);
+void close_trace();
+
+} // namespace ai
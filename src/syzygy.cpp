@@ -0,0 +1,1120 @@
+#include "syzygy.hpp"
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace chess;
+
+// written from the description of the table format by its author, Ronald de
+// Man, following the design of the probing code he published with the
+// tables without restrictions on its use
+//
+// squares here are numbered as in the table files, from a1 = 0 to h8 = 63,
+// which is the game's numbering flipped vertically; pieces are numbered by
+// type, plus 8 for black
+#define TB_PIECES 7
+#define TB_BLACK 8
+
+unsigned syzygy::max_pieces = 0;
+
+// the first four bytes of each kind of file
+const uint8_t _WDL_MAGIC[] = {0x71, 0xe8, 0x23, 0x5d},
+              _DTZ_MAGIC[] = {0xd7, 0x66, 0x0c, 0xa5};
+
+// flags of a file, after its magic number
+enum { _SPLIT = 1, _PAWNS = 2 };
+// flags of each part of a file
+enum {
+  _DTZ_BLACK = 1,
+  _DTZ_MAPPED = 2,
+  _DTZ_WIN_PLIES = 4,
+  _DTZ_LOSS_PLIES = 8,
+  _DTZ_WIDE = 16,
+  _CONSTANT = 128,
+};
+
+uint16_t _read16(const uint8_t *data) { return data[0] | data[1] << 8; }
+uint32_t _read32(const uint8_t *data) {
+  return _read16(data) | (uint32_t)_read16(data + 2) << 16;
+}
+
+// reads the header of a file in order, where numbers are unaligned and
+// little-endian
+struct _Reader {
+  const uint8_t *at;
+
+  uint8_t byte() { return *at++; }
+  uint16_t word() {
+    at += 2;
+    return _read16(at - 2);
+  }
+  uint32_t dword() {
+    at += 4;
+    return _read32(at - 4);
+  }
+  const uint8_t *skip(size_t bytes) {
+    at += bytes;
+    return at - bytes;
+  }
+  // skip to a multiple of `alignment` bytes, counted from the start of the
+  // mapping since it's page aligned
+  void align(uintptr_t alignment) {
+    at = (const uint8_t *)(((uintptr_t)at + alignment - 1) & ~(alignment - 1));
+  }
+};
+
+// numberings of squares for turning a position into an index:
+// - `_TRIANGLE` numbers the squares of the triangle a1-d1-d4, the six off
+//   the a1-h8 diagonal first, which the leading piece of a pawnless table is
+//   mirrored into
+// - `_BELOW` numbers the 28 squares below the diagonal
+// - `_KINGS` numbers the 462 placements of two kings with the first in the
+//   triangle and the second not above the diagonal when the first is on it,
+//   those with both on the diagonal last
+// - `_PAWN_ORDER` numbers the squares a pawn can be on, higher nearer the a
+//   and h files and then nearer rank 2, the leading pawn being the highest
+// - `_LEAD[n][square]` and `_LEAD_SIZE[n][file]` number the placements of
+//   `n` leading pawns by the first one's square on files a to d
+// - `_CHOOSE[k][n]` counts the ways to choose `k` of `n` squares
+const uint8_t _TRIANGLE_SQUARES[10] = {1, 2, 3, 10, 11, 19, 0, 9, 18, 27};
+uint8_t _TRIANGLE[64], _BELOW[64], _PAWN_ORDER[64];
+uint16_t _KINGS[10][64];
+uint64_t _CHOOSE[TB_PIECES][65], _LEAD[TB_PIECES][64],
+    _LEAD_SIZE[TB_PIECES][4];
+
+// how far a square is above the a1-h8 diagonal, negative below it
+int _above_diagonal(int square) { return (square >> 3) - (square & 7); }
+
+static struct _Numberings {
+  _Numberings() {
+    for (int i = 0; i < 10; i++) {
+      _TRIANGLE[_TRIANGLE_SQUARES[i]] = i;
+    }
+    int below = 0;
+    for (int square = 0; square < 64; square++) {
+      if (_above_diagonal(square) < 0) {
+        _BELOW[square] = below++;
+      }
+    }
+    int placement = 0;
+    for (bool both_on_diagonal : {false, true}) {
+      for (int i = 0; i < 10; i++) {
+        int first = _TRIANGLE_SQUARES[i];
+        for (int second = 0; second < 64; second++) {
+          bool touching = std::abs((first & 7) - (second & 7)) <= 1 &&
+                          std::abs((first >> 3) - (second >> 3)) <= 1;
+          if (touching ||
+              (!_above_diagonal(first) && _above_diagonal(second) > 0)) {
+            continue;
+          }
+          if (both_on_diagonal ==
+              (!_above_diagonal(first) && !_above_diagonal(second))) {
+            _KINGS[i][second] = placement++;
+          }
+        }
+      }
+    }
+
+    for (int n = 0; n <= 64; n++) {
+      _CHOOSE[0][n] = 1;
+      for (int k = 1; k < TB_PIECES; k++) {
+        _CHOOSE[k][n] = n ? _CHOOSE[k - 1][n - 1] + _CHOOSE[k][n - 1] : 0;
+      }
+    }
+
+    for (int file = 0; file < 4; file++) {
+      for (int rank = 1; rank < 7; rank++) {
+        int order = 47 - 12 * file - 2 * (rank - 1);
+        _PAWN_ORDER[rank * 8 + file] = order;
+        _PAWN_ORDER[rank * 8 + 7 - file] = order - 1;
+      }
+    }
+    // the other leading pawns are on squares ordered below the first
+    for (int n = 1; n < TB_PIECES - 1; n++) {
+      for (int file = 0; file < 4; file++) {
+        uint64_t placements = 0;
+        for (int rank = 1; rank < 7; rank++) {
+          _LEAD[n][rank * 8 + file] = placements;
+          placements += _CHOOSE[n - 1][_PAWN_ORDER[rank * 8 + file]];
+        }
+        _LEAD_SIZE[n][file] = placements;
+      }
+    }
+  }
+} _numberings;
+
+// the values of one part of a file, one for each index, compressed as a
+// canonical Huffman code of symbols that each stand for a run of values, and
+// split into blocks of a fixed number of bytes
+struct _Values {
+  // every value is `value`, and nothing else is kept
+  bool constant = false;
+  uint8_t value = 0;
+  unsigned block_bits = 0, span_bits = 0, min_length = 0;
+  // the blocks of data, and the blocks counted in `block_counts`, which may
+  // be padded
+  uint32_t blocks = 0, counted_blocks = 0;
+  uint64_t entries = 0;
+  // the first symbol of each code length, the pair of symbols each symbol
+  // stands for, the number of values less one of each block, the block and
+  // offset in it of the value in the middle of each span of indexes, and
+  // the blocks
+  const uint8_t *first_symbol = nullptr, *pairs = nullptr,
+                *block_counts = nullptr, *entry_data = nullptr,
+                *data = nullptr;
+  // the lowest code of each length, aligned to the top of 64 bits, and the
+  // number of values each symbol stands for
+  std::vector<uint64_t> lowest_code;
+  std::vector<uint32_t> runs;
+};
+
+// one part of a file, for a side to move and file of the leading pawn
+struct _Part {
+  // the pieces in the order they're encoded, the sizes of the groups of
+  // them encoded together, and the number each group's index is multiplied
+  // by
+  uint8_t pieces[TB_PIECES];
+  unsigned groups;
+  unsigned group_size[TB_PIECES];
+  uint64_t factor[TB_PIECES];
+  uint64_t size;
+  uint8_t flags;
+  _Values values;
+  // for distance tables, the offset of the map of each result's values, in
+  // the order win, loss, cursed win, blessed loss
+  uint32_t map[4];
+};
+
+// a win/draw/loss or distance file for one set of material
+struct _Table {
+  std::string path;
+  bool dtz;
+  // the material with the side named first in the file as white, and as
+  // black
+  uint64_t keys[2];
+  unsigned pieces;
+  bool unique;
+  // the pawns of the color encoded first, and of the other
+  unsigned lead_pawns, other_pawns;
+  // set once the file has been mapped or has failed to map, after which
+  // `base` is null if it failed
+  std::atomic<bool> ready{false};
+  void *base = nullptr;
+  size_t size = 0;
+  bool pawns = false;
+  unsigned sides = 1;
+  const uint8_t *maps = nullptr;
+  _Part parts[2][4];
+
+  bool symmetric() const { return keys[WHITE] == keys[BLACK]; }
+};
+
+// the tables found, and the win/draw/loss and distance tables of each
+// material key
+std::vector<std::unique_ptr<_Table>> _tables;
+struct _Entry {
+  _Table *wdl, *dtz;
+};
+std::unordered_map<uint64_t, _Entry> _entries;
+std::mutex _load_mutex;
+
+// a key of a position's material, each color's count of each type in 4 bits
+uint64_t _material_key(const Position &position) {
+  uint64_t key = 0;
+  for (Color color : {BLACK, WHITE}) {
+    for (uint8_t type = Piece::PAWN; type <= Piece::KING; type++) {
+      key |= (uint64_t)popcount(position.pieces(color, (Piece::Type)type))
+             << 4 * (color * 6 + type - 1);
+    }
+  }
+  return key;
+}
+
+// the material key of a file name such as `KRPvKR`, with the first side
+// given the color `first`
+uint64_t _name_key(const std::string &name, Color first) {
+  uint64_t key = 0;
+  Color color = first;
+  for (char c : name) {
+    if (c == 'v') {
+      color = opponent(color);
+    } else {
+      int type = strchr(" PNBRQK", c) - " PNBRQK";
+      key += (uint64_t)1 << 4 * (color * 6 + type - 1);
+    }
+  }
+  return key;
+}
+
+void _unmap(_Table &table) {
+  if (table.base) {
+    munmap(table.base, table.size);
+  }
+}
+
+// the two symbols a symbol stands for, where a second symbol of 0xfff means
+// the symbol is the single value given as the first
+void _pair(const _Values &values, unsigned symbol, unsigned &first,
+           unsigned &second) {
+  const uint8_t *pair = values.pairs + 3 * symbol;
+  first = pair[0] | (pair[1] & 0xf) << 8;
+  second = pair[1] >> 4 | pair[2] << 4;
+}
+
+uint32_t _run(_Values &values, unsigned symbol) {
+  if (!values.runs[symbol]) {
+    unsigned first, second;
+    _pair(values, symbol, first, second);
+    values.runs[symbol] =
+        second == 0xfff ? 1 : _run(values, first) + _run(values, second);
+  }
+  return values.runs[symbol];
+}
+
+// read how a part's values are compressed
+void _read_values(_Part &part, _Reader &reader) {
+  _Values &values = part.values;
+  part.flags = reader.byte();
+  if (part.flags & _CONSTANT) {
+    values.constant = true;
+    values.value = reader.byte();
+    return;
+  }
+  values.block_bits = reader.byte();
+  values.span_bits = reader.byte();
+  uint8_t padding = reader.byte();
+  values.blocks = reader.dword();
+  values.counted_blocks = values.blocks + padding;
+  values.entries = ((part.size - 1) >> values.span_bits) + 1;
+  unsigned max_length = reader.byte();
+  values.min_length = reader.byte();
+  unsigned lengths = max_length - values.min_length + 1;
+  values.first_symbol = reader.skip(2 * lengths);
+  unsigned symbols = reader.word();
+  values.pairs = reader.skip(3 * symbols + (symbols & 1));
+
+  // the codes of each length follow on from those of the next longer
+  // length, which start from 0 at the longest
+  values.lowest_code.assign(lengths, 0);
+  for (int i = lengths - 2; i >= 0; i--) {
+    unsigned longer = _read16(values.first_symbol + 2 * i) -
+                      _read16(values.first_symbol + 2 * (i + 1));
+    values.lowest_code[i] = (values.lowest_code[i + 1] + longer) / 2;
+  }
+  for (unsigned i = 0; i < lengths; i++) {
+    values.lowest_code[i] <<= 64 - values.min_length - i;
+  }
+  values.runs.assign(symbols, 0);
+  for (unsigned symbol = 0; symbol < symbols; symbol++) {
+    _run(values, symbol);
+  }
+}
+
+// find the groups of a part's pieces and the factor of each group's index,
+// given which of the groups in turn the leading group and the other color's
+// pawns are multiplied in as
+void _encode_groups(const _Table &table, _Part &part, unsigned lead_order,
+                    unsigned pawn_order, unsigned file) {
+  unsigned lead = table.pawns    ? table.lead_pawns
+                  : table.unique ? 3
+                                 : 2;
+  part.groups = 0;
+  part.group_size[part.groups++] = lead;
+  if (table.other_pawns) {
+    part.group_size[part.groups++] = table.other_pawns;
+  }
+  for (unsigned i = lead + table.other_pawns; i < table.pieces; i++) {
+    if (i > lead + table.other_pawns && part.pieces[i] == part.pieces[i - 1]) {
+      part.group_size[part.groups - 1]++;
+    } else {
+      part.group_size[part.groups++] = 1;
+    }
+  }
+
+  unsigned next = table.other_pawns ? 2 : 1;
+  unsigned free_squares = 64 - lead - table.other_pawns;
+  part.size = 1;
+  for (unsigned turn = 0;
+       next < part.groups || turn == lead_order || turn == pawn_order;
+       turn++) {
+    if (turn == lead_order) {
+      part.factor[0] = part.size;
+      part.size *= table.pawns    ? _LEAD_SIZE[lead][file]
+                   : table.unique ? 31332
+                                  : 462;
+    } else if (turn == pawn_order) {
+      part.factor[1] = part.size;
+      part.size *= _CHOOSE[table.other_pawns][48 - lead];
+    } else {
+      part.factor[next] = part.size;
+      part.size *= _CHOOSE[part.group_size[next]][free_squares];
+      free_squares -= part.group_size[next++];
+    }
+  }
+}
+
+// read the layout of a mapped file: the piece order of each part, how the
+// values of each are compressed, the maps of distance values, and where the
+// entries, block counts and blocks of each part are
+void _read_layout(_Table &table, const uint8_t *data) {
+  table.pawns = data[4] & _PAWNS;
+  table.sides = !table.dtz && (data[4] & _SPLIT) ? 2 : 1;
+  unsigned files = table.pawns ? 4 : 1;
+  _Reader reader = {data + 5};
+  for (unsigned file = 0; file < files; file++) {
+    uint8_t lead_order = reader.byte();
+    uint8_t pawn_order = table.other_pawns ? reader.byte() : 0xff;
+    for (unsigned i = 0; i < table.pieces; i++) {
+      uint8_t pieces = reader.byte();
+      table.parts[0][file].pieces[i] = pieces & 0xf;
+      table.parts[1][file].pieces[i] = pieces >> 4;
+    }
+    for (unsigned side = 0; side < table.sides; side++) {
+      _encode_groups(table, table.parts[side][file],
+                     side ? lead_order >> 4 : lead_order & 0xf,
+                     side ? pawn_order >> 4 : pawn_order & 0xf, file);
+    }
+  }
+  reader.align(2);
+  for (unsigned file = 0; file < files; file++) {
+    for (unsigned side = 0; side < table.sides; side++) {
+      _read_values(table.parts[side][file], reader);
+    }
+  }
+  if (table.dtz) {
+    table.maps = reader.at;
+    for (unsigned file = 0; file < files; file++) {
+      _Part &part = table.parts[0][file];
+      if (!(part.flags & _DTZ_MAPPED)) {
+        continue;
+      }
+      bool wide = part.flags & _DTZ_WIDE;
+      if (wide) {
+        reader.align(2);
+      }
+      for (uint32_t &map : part.map) {
+        unsigned size = wide ? reader.word() : reader.byte();
+        map = reader.at - table.maps;
+        reader.skip(wide ? 2 * size : size);
+      }
+    }
+    reader.align(2);
+  }
+  for (unsigned file = 0; file < files; file++) {
+    for (unsigned side = 0; side < table.sides; side++) {
+      _Values &values = table.parts[side][file].values;
+      values.entry_data = reader.skip(6 * values.entries);
+    }
+  }
+  for (unsigned file = 0; file < files; file++) {
+    for (unsigned side = 0; side < table.sides; side++) {
+      _Values &values = table.parts[side][file].values;
+      values.block_counts = reader.skip(2 * values.counted_blocks);
+    }
+  }
+  for (unsigned file = 0; file < files; file++) {
+    for (unsigned side = 0; side < table.sides; side++) {
+      _Values &values = table.parts[side][file].values;
+      reader.align(64);
+      values.data = reader.skip((size_t)values.blocks << values.block_bits);
+    }
+  }
+}
+
+// map a table's file into memory and read its layout the first time it's
+// probed, returning false if it can't be read
+bool _load(_Table &table) {
+  if (table.ready.load(std::memory_order_acquire)) {
+    return table.base;
+  }
+  std::lock_guard<std::mutex> lock(_load_mutex);
+  if (table.ready.load(std::memory_order_relaxed)) {
+    return table.base;
+  }
+  int fd = open(table.path.c_str(), O_RDONLY);
+  struct stat info;
+  // every file is a whole number of 64 byte blocks plus a 16 byte header
+  if (fd >= 0 && !fstat(fd, &info) && info.st_size % 64 == 16) {
+    void *base = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base != MAP_FAILED) {
+      madvise(base, info.st_size, MADV_RANDOM);
+      table.base = base;
+      table.size = info.st_size;
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  const uint8_t *data = (const uint8_t *)table.base;
+  if (data && (memcmp(data, table.dtz ? _DTZ_MAGIC : _WDL_MAGIC, 4) ||
+               (bool)(data[4] & _PAWNS) != (table.lead_pawns > 0))) {
+    _unmap(table);
+    table.base = nullptr;
+  }
+  if (table.base) {
+    _read_layout(table, data);
+  }
+  table.ready.store(true, std::memory_order_release);
+  return table.base;
+}
+
+// get the value at an index of a part
+unsigned _value_at(const _Values &values, uint64_t index) {
+  if (values.constant) {
+    return values.value;
+  }
+  // each entry gives the block and offset of the middle of its span, from
+  // which the blocks are counted to the one holding the index
+  uint64_t span = (uint64_t)1 << values.span_bits;
+  const uint8_t *entry = values.entry_data + 6 * (index >> values.span_bits);
+  uint32_t block = _read32(entry);
+  int64_t offset = (int64_t)(_read16(entry + 4) + index % span) -
+                   (int64_t)(span / 2);
+  while (offset < 0) {
+    offset += _read16(values.block_counts + 2 * --block) + 1;
+  }
+  for (;;) {
+    int64_t count = _read16(values.block_counts + 2 * block) + 1;
+    if (offset < count) {
+      break;
+    }
+    offset -= count;
+    block++;
+  }
+
+  // the block is a big-endian stream of codes, read through a window of its
+  // next 64 bits, until reaching the symbol whose run covers the offset
+  const uint8_t *data = values.data + ((uint64_t)block << values.block_bits);
+  uint64_t window = 0;
+  int bits = 0;
+  unsigned symbol;
+  for (;;) {
+    for (; bits <= 56; bits += 8) {
+      window |= (uint64_t)*data++ << (56 - bits);
+    }
+    unsigned length = 0;
+    while (window < values.lowest_code[length]) {
+      length++;
+    }
+    unsigned code_bits = values.min_length + length;
+    symbol = _read16(values.first_symbol + 2 * length) +
+             ((window - values.lowest_code[length]) >> (64 - code_bits));
+    if (offset < values.runs[symbol]) {
+      break;
+    }
+    offset -= values.runs[symbol];
+    window <<= code_bits;
+    bits -= code_bits;
+  }
+  // then split the symbol into its pairs down to the value at the offset
+  for (;;) {
+    unsigned first, second;
+    _pair(values, symbol, first, second);
+    if (second == 0xfff) {
+      return first;
+    }
+    if (offset < values.runs[first]) {
+      symbol = first;
+    } else {
+      offset -= values.runs[first];
+      symbol = second;
+    }
+  }
+}
+
+bool _pawn_behind(int a, int b) { return _PAWN_ORDER[a] < _PAWN_ORDER[b]; }
+
+// find the part of a table a position is in and its index there, returning
+// null if it's a distance table that only has the other side to move
+const _Part *_locate(const Game &game, const _Table &table, uint64_t &index) {
+  // the tables have the side named first as white, and symmetric tables
+  // only white to move, so otherwise the colors and ranks are swapped
+  bool swap = table.symmetric() ? game.turn == BLACK
+                                : _material_key(game) != table.keys[WHITE];
+  unsigned side = (game.turn == BLACK) != swap;
+  uint8_t flip = swap ? 0 : 56, swap_color = swap ? TB_BLACK : 0;
+
+  // the squares of each piece, in the table's numbering
+  Bitboard squares_of[16] = {};
+  for (Bitboard b = game.occupancy[BLACK] | game.occupancy[WHITE]; b;) {
+    uint8_t square = pop_lsb(b);
+    Piece piece = game.piece_at(square);
+    uint8_t code = piece.type | (piece.color == BLACK ? TB_BLACK : 0);
+    squares_of[code ^ swap_color] |= bit(square ^ flip);
+  }
+
+  // pawn tables are split by the file of the leading pawn
+  unsigned file = 0;
+  if (table.pawns) {
+    int first = -1;
+    for (Bitboard b = squares_of[table.parts[0][0].pieces[0]]; b;) {
+      int square = pop_lsb(b);
+      if (first < 0 || _pawn_behind(first, square)) {
+        first = square;
+      }
+    }
+    file = std::min(first & 7, 7 - (first & 7));
+  }
+  const _Part &part = table.parts[side < table.sides ? side : 0][file];
+  if (table.dtz && (part.flags & _DTZ_BLACK) != side &&
+      (table.pawns || !table.symmetric())) {
+    return nullptr;
+  }
+
+  // place the pieces in the part's order, the leading pawn first, and
+  // mirror the board so the first piece is on files a to d
+  int squares[TB_PIECES] = {};
+  for (unsigned i = 0; i < table.pieces; i++) {
+    squares[i] = pop_lsb(squares_of[part.pieces[i]]);
+  }
+  if (table.pawns) {
+    std::swap(squares[0], *std::max_element(squares,
+                                             squares + table.lead_pawns,
+                                             _pawn_behind));
+  }
+  if ((squares[0] & 7) > 3) {
+    for (unsigned i = 0; i < table.pieces; i++) {
+      squares[i] ^= 7;
+    }
+  }
+
+  if (table.pawns) {
+    // the other leading pawns are a set of the squares ordered below the
+    // first
+    std::stable_sort(squares + 1, squares + table.lead_pawns, _pawn_behind);
+    index = _LEAD[table.lead_pawns][squares[0]];
+    for (unsigned i = 1; i < table.lead_pawns; i++) {
+      index += _CHOOSE[i][_PAWN_ORDER[squares[i]]];
+    }
+  } else {
+    // without pawns the first piece is also mirrored onto ranks 1 to 4, and
+    // then the first of the leading group off the diagonal below it
+    if ((squares[0] >> 3) > 3) {
+      for (unsigned i = 0; i < table.pieces; i++) {
+        squares[i] ^= 56;
+      }
+    }
+    for (unsigned i = 0; i < part.group_size[0]; i++) {
+      if (_above_diagonal(squares[i]) > 0) {
+        for (unsigned j = 0; j < table.pieces; j++) {
+          squares[j] = (squares[j] >> 3 | squares[j] << 3) & 63;
+        }
+      }
+      if (_above_diagonal(squares[i])) {
+        break;
+      }
+    }
+    if (table.unique) {
+      // three unique pieces, by how many of them are on the diagonal, each
+      // skipping the squares of those before
+      int s0 = squares[0], s1 = squares[1], s2 = squares[2];
+      int skip1 = s1 > s0, skip2 = (s2 > s0) + (s2 > s1);
+      if (_above_diagonal(s0)) {
+        index = (_TRIANGLE[s0] * 63 + s1 - skip1) * 62 + s2 - skip2;
+      } else if (_above_diagonal(s1)) {
+        index = 6 * 63 * 62 + ((s0 >> 3) * 28 + _BELOW[s1]) * 62 + s2 - skip2;
+      } else if (_above_diagonal(s2)) {
+        index = 6 * 63 * 62 + 4 * 28 * 62 +
+                ((s0 >> 3) * 7 + (s1 >> 3) - skip1) * 28 + _BELOW[s2];
+      } else {
+        index = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28 +
+                ((s0 >> 3) * 7 + (s1 >> 3) - skip1) * 6 + (s2 >> 3) - skip2;
+      }
+    } else {
+      index = _KINGS[_TRIANGLE[squares[0]]][squares[1]];
+    }
+  }
+  index *= part.factor[0];
+
+  // each other group is a set of squares, numbered in ascending order
+  // skipping the squares of the groups before, and ranks 1 and 8 for the
+  // other color's pawns
+  unsigned start = part.group_size[0];
+  for (unsigned group = 1; group < part.groups; group++) {
+    int *members = squares + start;
+    unsigned size = part.group_size[group];
+    std::stable_sort(members, members + size);
+    uint64_t set = 0;
+    for (unsigned i = 0; i < size; i++) {
+      int square = members[i] - (group == 1 && table.other_pawns ? 8 : 0);
+      for (int *s = squares; s < members; s++) {
+        square -= *s < members[i];
+      }
+      set += _CHOOSE[i + 1][square];
+    }
+    index += set * part.factor[group];
+    start += size;
+  }
+  return &part;
+}
+
+// find the table of a position's material and map it, returning null if it
+// isn't found or can't be read
+_Table *_find_table(const Game &game, bool dtz) {
+  auto it = _entries.find(_material_key(game));
+  _Table *table =
+      it == _entries.end() ? nullptr : dtz ? it->second.dtz : it->second.wdl;
+  return table && _load(*table) ? table : nullptr;
+}
+
+// look up a position's result in its win/draw/loss table, which is right
+// unless a capture, en passant included, is the best move
+int _stored_wdl(const Game &game, bool &found) {
+  if (popcount(game.occupancy[BLACK] | game.occupancy[WHITE]) == 2) {
+    return syzygy::DRAW;
+  }
+  _Table *table = _find_table(game, false);
+  if (!table) {
+    found = false;
+    return 0;
+  }
+  uint64_t index = 0;
+  const _Part *part = _locate(game, *table, index);
+  return (int)_value_at(part->values, index) - 2;
+}
+
+// look up a position's distance in plies in its distance table given its
+// result, setting `other_side` if the table only has the other side to move
+int _stored_dtz(const Game &game, int wdl, bool &found, bool &other_side) {
+  _Table *table = _find_table(game, true);
+  if (!table) {
+    found = false;
+    return 0;
+  }
+  uint64_t index = 0;
+  const _Part *part = _locate(game, *table, index);
+  if (!part) {
+    other_side = true;
+    return 0;
+  }
+  unsigned value = _value_at(part->values, index);
+  if (part->flags & _DTZ_MAPPED) {
+    const int MAPS[] = {1, 3, 0, 2, 0};
+    const uint8_t *map = table->maps + part->map[MAPS[wdl + 2]];
+    value = part->flags & _DTZ_WIDE ? _read16(map + 2 * value) : map[value];
+  }
+  // distances are kept in moves rather than plies unless flagged, and
+  // always for the results the fifty-move rule makes draws
+  bool plies = (wdl == syzygy::WIN && (part->flags & _DTZ_WIN_PLIES)) ||
+               (wdl == syzygy::LOSS && (part->flags & _DTZ_LOSS_PLIES));
+  return (plies ? value : 2 * value) + 1;
+}
+
+int _sign(int value) { return (value > 0) - (value < 0); }
+
+// the distance of a position with a result whose best move is a capture or
+// pawn move
+int _zeroing_dtz(int wdl) {
+  return wdl == syzygy::WIN            ? 1
+         : wdl == syzygy::CURSED_WIN   ? 101
+         : wdl == syzygy::BLESSED_LOSS ? -101
+         : wdl == syzygy::LOSS         ? -1
+                                       : 0;
+}
+
+// orders distances from worst to best for the side to move: the shortest
+// loss, then the longer ones, blessed losses, draws, cursed wins, and the
+// shortest win last
+int _dtz_rank(int dtz) {
+  return dtz > 0 ? 0x10000 - dtz : dtz < 0 ? -0x10000 - dtz : 0;
+}
+
+bool _is_en_passant(const Game &game, Move move) {
+  return move.to() == game.en_passant && move.x1() != move.x2() &&
+         game.piece_at(move.from()).type == Piece::PAWN;
+}
+
+Player *_mover(Game &game) {
+  return game.turn == WHITE ? &game.white : &game.black;
+}
+
+// the result of a position, which is its table's unless a capture does
+// better since the tables don't account for captures that are best; the
+// captures other than en passant are searched with bounds `alpha` and
+// `beta`, and `capture_wins` is set if one wins and is at least as good as
+// the table
+int _search_captures(Game &game, int alpha, int beta, bool &found,
+                     bool &capture_wins) {
+  MoveList moves;
+  game.get_moves(_mover(game), moves, CAPTURES);
+  bool ignored;
+  for (Move move : moves) {
+    if (!game.squares[move.to()]) {
+      continue;
+    }
+    game.make_move(move);
+    int value = -_search_captures(game, -beta, -alpha, found, ignored);
+    game.undo_move(move);
+    if (!found) {
+      return 0;
+    }
+    if (value > alpha) {
+      alpha = value;
+      if (value >= beta) {
+        capture_wins = value > syzygy::DRAW;
+        return value;
+      }
+    }
+  }
+  int value = _stored_wdl(game, found);
+  capture_wins = alpha > syzygy::DRAW && alpha >= value;
+  return std::max(alpha, value);
+}
+
+// the best result of a position's en passant captures, or -3 if there are
+// none, and whether it has other moves
+int _en_passant_wdl(Game &game, bool &found, bool &other_moves) {
+  MoveList moves;
+  game.get_moves(_mover(game), moves);
+  int best = -3;
+  other_moves = false;
+  bool ignored;
+  for (Move move : moves) {
+    if (!_is_en_passant(game, move)) {
+      other_moves = true;
+      continue;
+    }
+    game.make_move(move);
+    int value = -_search_captures(game, -2, 2, found, ignored);
+    game.undo_move(move);
+    if (!found) {
+      return 0;
+    }
+    best = std::max(best, value);
+  }
+  return best;
+}
+
+int _probe_wdl(Game &game, bool &found) {
+  bool capture_wins, other_moves;
+  int wdl = _search_captures(game, -2, 2, found, capture_wins);
+  if (!found || game.en_passant == NO_SQUARE) {
+    return wdl;
+  }
+  // the tables assume en passant isn't possible, so where it's the only
+  // move they have a stalemate
+  int en_passant = _en_passant_wdl(game, found, other_moves);
+  return en_passant > -3 && (en_passant >= wdl || !other_moves) ? en_passant
+                                                                 : wdl;
+}
+
+int _probe_dtz(Game &game, bool &found);
+
+// the distance of a position as if en passant weren't possible
+int _dtz_without_en_passant(Game &game, bool &found) {
+  bool capture_wins;
+  int wdl = _search_captures(game, -2, 2, found, capture_wins);
+  // draws have no distance, and the distance table's value can't be trusted
+  // when a capture or pawn move is best
+  if (!found || wdl == syzygy::DRAW) {
+    return 0;
+  }
+  if (capture_wins) {
+    return _zeroing_dtz(wdl);
+  }
+  MoveList moves;
+  game.get_moves(_mover(game), moves);
+  bool ignored;
+  if (wdl > 0) {
+    for (Move move : moves) {
+      if (game.is_capture(move) ||
+          game.piece_at(move.from()).type != Piece::PAWN) {
+        continue;
+      }
+      game.make_move(move);
+      int value = -_search_captures(game, -2, -wdl + 1, found, ignored);
+      game.undo_move(move);
+      if (!found) {
+        return 0;
+      }
+      if (value == wdl) {
+        return _zeroing_dtz(wdl);
+      }
+    }
+  }
+  bool other_side = false;
+  int dtz = _stored_dtz(game, wdl, found, other_side);
+  if (!found) {
+    return 0;
+  }
+  if (!other_side) {
+    return (dtz + (wdl & 1 ? 100 : 0)) * _sign(wdl);
+  }
+
+  // the table only has the other side to move, so take the best distance
+  // after each move: a win goes on with a move that isn't a capture or pawn
+  // move, as those were searched, and a loss with any move
+  Player *other = game.turn == WHITE ? &game.black : &game.white;
+  int best = 0xffff;
+  for (Move move : moves) {
+    bool zeroing = game.is_capture(move) ||
+                   game.piece_at(move.from()).type == Piece::PAWN;
+    if (wdl > 0 && zeroing) {
+      continue;
+    }
+    game.make_move(move);
+    int value;
+    if (wdl > 0) {
+      value = -_probe_dtz(game, found);
+      // a mate is the shortest win there is
+      if (value > 0 && !(value == 1 && game.get_state(other) == Game::LOSS)) {
+        value++;
+      }
+    } else if (zeroing) {
+      value = wdl == syzygy::LOSS ? -1
+              : _search_captures(game, 1, 2, found, ignored) == syzygy::WIN
+                  ? 0
+                  : -101;
+    } else {
+      value = -_probe_dtz(game, found) - 1;
+    }
+    game.undo_move(move);
+    if (!found) {
+      return 0;
+    }
+    if (_sign(value) == _sign(wdl) && value < best) {
+      best = value;
+    }
+  }
+  // without a move of the same result, the position is mated
+  return best == 0xffff ? -1 : best;
+}
+
+int _probe_dtz(Game &game, bool &found) {
+  int dtz = _dtz_without_en_passant(game, found);
+  if (!found || game.en_passant == NO_SQUARE) {
+    return dtz;
+  }
+  // an en passant capture is taken if it does better, or if it's the only
+  // move
+  bool other_moves;
+  int en_passant = _en_passant_wdl(game, found, other_moves);
+  if (en_passant == -3) {
+    return dtz;
+  }
+  int en_passant_dtz = _zeroing_dtz(en_passant);
+  return _dtz_rank(en_passant_dtz) > _dtz_rank(dtz) || !other_moves
+             ? en_passant_dtz
+             : dtz;
+}
+
+// determines if a position can be in the tables
+bool _probeable(Game &game) {
+  return !game.castling &&
+         popcount(game.occupancy[BLACK] | game.occupancy[WHITE]) <=
+             syzygy::max_pieces;
+}
+
+unsigned syzygy::init(const std::string &paths) {
+  for (auto &table : _tables) {
+    _unmap(*table);
+  }
+  _tables.clear();
+  _entries.clear();
+  max_pieces = 0;
+  std::vector<std::string> directories;
+  for (size_t start = 0; start <= paths.size();) {
+    size_t end = std::min(paths.find(':', start), paths.size());
+    if (end > start) {
+      directories.push_back(paths.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+  if (directories.empty()) {
+    return 0;
+  }
+  // every side's pieces besides the king, strongest first as in the file
+  // names
+  const char *order = "QRBNP";
+  std::vector<std::string> sides = {""};
+  for (size_t i = 0; i < sides.size(); i++) {
+    if (sides[i].size() == TB_PIECES - 2) {
+      continue;
+    }
+    for (const char *c = order; *c; c++) {
+      if (sides[i].empty() || strchr(order, sides[i].back()) <= c) {
+        sides.push_back(sides[i] + *c);
+      }
+    }
+  }
+  unsigned found = 0;
+  for (const std::string &strong : sides) {
+    for (const std::string &weak : sides) {
+      if (strong.size() + weak.size() + 2 > TB_PIECES) {
+        continue;
+      }
+      std::string name = "K" + strong + "vK" + weak;
+      _Entry entry = {nullptr, nullptr};
+      for (bool dtz : {false, true}) {
+        for (const std::string &directory : directories) {
+          std::string path =
+              directory + "/" + name + (dtz ? ".rtbz" : ".rtbw");
+          if (access(path.c_str(), R_OK)) {
+            continue;
+          }
+          _Table *table = new _Table;
+          _tables.emplace_back(table);
+          table->path = path;
+          table->dtz = dtz;
+          table->keys[WHITE] = _name_key(name, WHITE);
+          table->keys[BLACK] = _name_key(name, BLACK);
+          table->pieces = name.size() - 1;
+          table->unique = false;
+          for (const std::string *side : {&strong, &weak}) {
+            for (char c : *side) {
+              if (std::count(side->begin(), side->end(), c) == 1) {
+                table->unique = true;
+              }
+            }
+          }
+          // the color with fewer pawns leads, since that compresses better,
+          // unless it has none
+          unsigned strong_pawns = std::count(strong.begin(), strong.end(), 'P'),
+                   weak_pawns = std::count(weak.begin(), weak.end(), 'P');
+          bool strong_leads =
+              !weak_pawns || (strong_pawns && weak_pawns >= strong_pawns);
+          table->lead_pawns = strong_leads ? strong_pawns : weak_pawns;
+          table->other_pawns = strong_leads ? weak_pawns : strong_pawns;
+          (dtz ? entry.dtz : entry.wdl) = table;
+          break;
+        }
+      }
+      if (!entry.wdl) {
+        continue;
+      }
+      _entries[_name_key(name, WHITE)] = entry;
+      _entries[_name_key(name, BLACK)] = entry;
+      max_pieces = std::max(max_pieces, (unsigned)name.size() - 1);
+      found++;
+    }
+  }
+  return found;
+}
+
+bool syzygy::probe_wdl(Game &game, WDL &wdl) {
+  if (!_probeable(game)) {
+    return false;
+  }
+  bool found = true;
+  wdl = (WDL)_probe_wdl(game, found);
+  return found;
+}
+
+bool syzygy::probe_dtz(Game &game, int &dtz) {
+  if (!_probeable(game)) {
+    return false;
+  }
+  bool found = true;
+  dtz = _probe_dtz(game, found);
+  return found;
+}
+
+// rank each root move by its distance counted from the root, or with
+// `use_dtz` unset by its result alone, returning false if a table is missing
+bool _rank_moves(Game &game, MoveList &moves, bool use_dtz, int *ranks) {
+  Player *other = game.turn == WHITE ? &game.black : &game.white;
+  bool found = true;
+  for (unsigned i = 0; i < moves.size && found; i++) {
+    game.make_move(moves[i]);
+    if (game.get_state(other) == Game::LOSS) {
+      ranks[i] = use_dtz ? _dtz_rank(1) : syzygy::WIN;
+    } else if (!use_dtz) {
+      ranks[i] = -_probe_wdl(game, found);
+    } else if (!game.halfmove_clock) {
+      ranks[i] = _dtz_rank(_zeroing_dtz(-_probe_wdl(game, found)));
+    } else {
+      // the fifty-move rule draws a game that reaches 100 plies first
+      int dtz = game.halfmove_clock < 100 ? -_probe_dtz(game, found) : 0;
+      ranks[i] = _dtz_rank(dtz + _sign(dtz));
+    }
+    game.undo_move(moves[i]);
+  }
+  return found;
+}
+
+bool syzygy::filter_root_moves(Game &game, MoveList &moves) {
+  int ranks[MAX_MOVES];
+  if (!_probeable(game) || !moves.size ||
+      (!_rank_moves(game, moves, true, ranks) &&
+       !_rank_moves(game, moves, false, ranks))) {
+    return false;
+  }
+  int best = *std::max_element(ranks, ranks + moves.size);
+  unsigned kept = 0;
+  for (unsigned i = 0; i < moves.size; i++) {
+    if (ranks[i] == best) {
+      moves[kept++] = moves[i];
+    }
+  }
+  moves.size = kept;
+  return true;
+}
+
+bool syzygy::test() {
+  // the distances of wins and losses may be a ply longer than the shortest,
+  // as the tables keep some distances in moves
+  const struct {
+    const char *fen;
+    WDL wdl;
+    int dtz;
+  } positions[] = {
+      // mate with the rook, or be mated after the only king move
+      {"6k1/8/6K1/8/8/8/8/R7 w - - 0 1", WIN, 1},
+      {"k7/8/1K6/8/8/8/8/7R b - - 0 1", LOSS, -2},
+      // the king takes the undefended rook or pawn
+      {"8/8/8/8/8/8/1k6/R6K b - - 0 1", DRAW, 0},
+      {"8/8/8/8/8/8/3kP3/7K b - - 0 1", DRAW, 0},
+      // promote out of reach of the king
+      {"8/4P3/8/8/8/8/k7/4K3 w - - 0 1", WIN, 1},
+      // take en passant and queen the pawn before the king catches it
+      {"8/8/8/8/4Pp2/8/8/K6k b - e3 0 1", WIN, 1},
+      // the longest loss against a rook, mated 16 moves later
+      {"K7/1Rk5/8/8/8/8/8/8 b - - 0 1", LOSS, -32},
+      // the king in front of its pawn on the sixth rank wins whoever moves,
+      // and the defending king in front of the pawn with the opposition
+      // draws
+      {"4k3/8/4K3/4P3/8/8/8/8 w - - 0 1", WIN, 3},
+      {"4k3/8/4K3/4P3/8/8/8/8 b - - 0 1", LOSS, -4},
+      {"8/8/8/4k3/8/8/4P3/4K3 w - - 0 1", DRAW, 0},
+      // the longest loss against king and pawn, the pawn held back until
+      // its king comes up
+      {"8/k7/8/8/K7/6P1/8/8 b - - 0 1", LOSS, -20},
+  };
+  if (max_pieces < 4) {
+    printf("Error: no tables of four pieces were found\n");
+    return false;
+  }
+  bool passed = true;
+  for (auto &position : positions) {
+    printf("Testing %s\n", position.fen);
+    Game game;
+    WDL wdl;
+    int dtz;
+    if (!game.load_fen(position.fen) || !probe_wdl(game, wdl) ||
+        !probe_dtz(game, dtz)) {
+      printf("Error: could not probe %s\n", position.fen);
+      passed = false;
+      continue;
+    }
+    if (wdl == position.wdl &&
+        (dtz == position.dtz ||
+         (_sign(dtz) == _sign(position.dtz) &&
+          std::abs(dtz - position.dtz) == 1))) {
+      printf("Correct!\n");
+    } else {
+      printf("Error: expected %d with distance %d, got %d with distance %d\n",
+             position.wdl, position.dtz, wdl, dtz);
+      passed = false;
+    }
+  }
+  return passed;
+}
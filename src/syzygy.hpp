@@ -0,0 +1,40 @@
+#include "chess.hpp"
+#include <string>
+#pragma once
+
+namespace syzygy {
+
+// the result of a position with best play from the side to move's point of
+// view, where cursed wins and blessed losses are those the fifty-move rule
+// turns into draws
+enum WDL { LOSS = -2, BLESSED_LOSS = -1, DRAW = 0, CURSED_WIN = 1, WIN = 2 };
+
+// most pieces, kings included, of any table found, or 0 if there are none
+extern unsigned max_pieces;
+
+// find the Syzygy tables in a list of directories separated by `:`,
+// replacing any found before, returning the number of positions sets found;
+// each file is mapped into memory the first time it's probed, so only the
+// pages a probe touches are read from disk
+unsigned init(const std::string &paths);
+
+// look up a position's result in the win/draw/loss tables, returning false if
+// it has castling rights or its table wasn't found
+bool probe_wdl(chess::Game &game, WDL &wdl);
+
+// look up the number of plies until the next capture or pawn move with best
+// play, positive if the side to move wins and negative if it loses, or 0 for
+// a draw; returns false if the position can't be looked up
+bool probe_dtz(chess::Game &game, int &dtz);
+
+// keep only the legal moves in `moves` that reach the best result, and reach
+// it soonest if the distance tables are found, returning false and leaving
+// the moves alone if the position can't be looked up
+bool filter_root_moves(chess::Game &game, chess::MoveList &moves);
+
+// check probing against positions of three and four pieces with known
+// results, printing each one's outcome as `Game::test` does, and returning
+// false if any is wrong or can't be probed, or no four piece tables were found
+bool test();
+
+} // namespace syzygy
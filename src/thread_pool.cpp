@@ -0,0 +1,112 @@
+#include "thread_pool.hpp"
+
+using namespace ai;
+
+// the pool the current thread works for and its queue there; threads outside
+// a pool, including the workers of other pools, share its first queue
+thread_local const ThreadPool *_queue_pool = nullptr;
+thread_local unsigned _queue_index = 0;
+
+ThreadPool::ThreadPool(unsigned num_threads) {
+  for (unsigned i = 0; i < std::max(num_threads, 1u); i++) {
+    _queues.emplace_back(new _Queue);
+  }
+  for (unsigned i = 1; i < _queues.size(); i++) {
+    _workers.emplace_back(&ThreadPool::_work, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _done = true;
+  }
+  _wake.notify_all();
+  for (std::thread &worker : _workers) {
+    worker.join();
+  }
+}
+
+void ThreadPool::submit(Group &group, std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    group.pending++;
+  }
+  _Queue &queue = *_queues[_index()];
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back({.group = &group, .run = std::move(task)});
+  }
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _queued++;
+  }
+  _wake.notify_one();
+}
+
+void ThreadPool::wait(Group &group) {
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _wake.wait(lock, [&] { return !group.pending || _queued; });
+      if (!group.pending) {
+        return;
+      }
+    }
+    _run_one(_index());
+  }
+}
+
+bool ThreadPool::_run_one(unsigned index) {
+  _Task task;
+  bool found = false;
+  // newest task of our own queue first, since its data is still in cache
+  {
+    _Queue &queue = *_queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+      found = true;
+    }
+  }
+  // otherwise the oldest, and usually largest, task of another queue
+  for (unsigned i = 1; !found && i < _queues.size(); i++) {
+    _Queue &queue = *_queues[(index + i) % _queues.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      found = true;
+    }
+  }
+  if (!found) {
+    return false;
+  }
+  _queued--;
+  task.run();
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (!--task.group->pending) {
+    _wake.notify_all();
+  }
+  return true;
+}
+
+unsigned ThreadPool::_index() const {
+  return _queue_pool == this ? _queue_index : 0;
+}
+
+void ThreadPool::_work(unsigned index) {
+  _queue_pool = this;
+  _queue_index = index;
+  for (;;) {
+    if (_run_one(index)) {
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(_mutex);
+    _wake.wait(lock, [this] { return _done || _queued; });
+    if (_done) {
+      return;
+    }
+  }
+}
@@ -0,0 +1,60 @@
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#pragma once
+
+namespace ai {
+
+// a fixed set of worker threads, each with its own queue of tasks; a thread
+// runs the newest task from its own queue and, once that is empty, steals the
+// oldest task from another thread's queue
+class ThreadPool {
+public:
+  // a set of tasks that can be waited on together
+  struct Group {
+    // tasks not finished yet, guarded by the pool's `_mutex`
+    unsigned pending = 0;
+  };
+
+  // start `num_threads - 1` workers, the thread calling `wait` being the last
+  ThreadPool(unsigned num_threads);
+  ~ThreadPool();
+  unsigned size() const { return _queues.size(); }
+  // queue a task on the calling thread's queue
+  void submit(Group &group, std::function<void()> task);
+  // run queued tasks until every task in the group has finished, sleeping
+  // while there are none to run
+  void wait(Group &group);
+
+private:
+  struct _Task {
+    Group *group;
+    std::function<void()> run;
+  };
+  struct _Queue {
+    std::mutex mutex;
+    std::deque<_Task> tasks;
+  };
+  std::vector<std::unique_ptr<_Queue>> _queues;
+  std::vector<std::thread> _workers;
+  // number of queued tasks, guarded by `_mutex` for sleeping workers
+  std::atomic<unsigned> _queued{0};
+  bool _done = false;
+  std::mutex _mutex;
+  // notified when a task is queued or a group's last task finishes
+  std::condition_variable _wake;
+
+  // the queue of the calling thread
+  unsigned _index() const;
+  // run one task, from the given queue or stolen from another, returning
+  // false if there was none
+  bool _run_one(unsigned index);
+  void _work(unsigned index);
+};
+
+} // namespace ai
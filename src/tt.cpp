@@ -0,0 +1,125 @@
+#include "tt.hpp"
+
+using namespace ai;
+
+// layout of a slot's data word
+#define GENERATION_BITS 6
+#define GENERATION_MASK ((1 << GENERATION_BITS) - 1)
+
+uint64_t _pack(const TTEntry &entry, uint8_t generation) {
+  return (uint64_t)(uint32_t)entry.rating | (uint64_t)entry.move << 32 |
+         (uint64_t)entry.depth << 48 | (uint64_t)entry.flag << 56 |
+         (uint64_t)generation << (64 - GENERATION_BITS);
+}
+
+TTEntry _unpack(uint64_t data) {
+  return {
+      .rating = (int32_t)(uint32_t)data,
+      .move = (uint16_t)(data >> 32),
+      .depth = (uint8_t)(data >> 48),
+      .flag = (TTEntry::Flag)((data >> 56) & 0b11),
+  };
+}
+
+uint8_t _data_generation(uint64_t data) {
+  return data >> (64 - GENERATION_BITS);
+}
+
+TranspositionTable::TranspositionTable(size_t mb) { resize(mb); }
+
+TranspositionTable::~TranspositionTable() { delete[] _buckets; }
+
+void TranspositionTable::resize(size_t mb) {
+  size_t num_buckets = 1;
+  while (num_buckets * 2 * sizeof(_Bucket) <= mb << 20) {
+    num_buckets *= 2;
+  }
+  if (num_buckets != _num_buckets) {
+    delete[] _buckets;
+    _buckets = new _Bucket[num_buckets];
+    _num_buckets = num_buckets;
+  }
+  clear();
+}
+
+void TranspositionTable::clear() {
+  for (size_t i = 0; i < _num_buckets; i++) {
+    for (_Slot &slot : _buckets[i].slots) {
+      slot.check.store(0, std::memory_order_relaxed);
+      slot.data.store(0, std::memory_order_relaxed);
+    }
+  }
+  _generation = 0;
+  _hits = _misses = _collisions = 0;
+}
+
+void TranspositionTable::new_search() {
+  _generation = (_generation + 1) & GENERATION_MASK;
+}
+
+bool TranspositionTable::probe(uint64_t key, TTEntry &entry) {
+  _Bucket &bucket = _buckets[key & (_num_buckets - 1)];
+  for (_Slot &slot : bucket.slots) {
+    uint64_t data = slot.data.load(std::memory_order_relaxed);
+    if ((slot.check.load(std::memory_order_relaxed) ^ data) == key && data) {
+      entry = _unpack(data);
+      _hits.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  _misses.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+void TranspositionTable::store(uint64_t key, TTEntry entry) {
+  _Bucket &bucket = _buckets[key & (_num_buckets - 1)];
+  _Slot *replace = nullptr;
+  int replace_score = INT32_MAX;
+  bool same_position = false;
+  for (_Slot &slot : bucket.slots) {
+    uint64_t data = slot.data.load(std::memory_order_relaxed);
+    // prefer the slot already holding this position
+    if ((slot.check.load(std::memory_order_relaxed) ^ data) == key && data) {
+      TTEntry old_entry = _unpack(data);
+      if (entry.depth + 2 < old_entry.depth && entry.flag != TTEntry::EXACT &&
+          _data_generation(data) == _generation) {
+        return;
+      }
+      if (!entry.move) {
+        entry.move = old_entry.move;
+      }
+      replace = &slot;
+      same_position = true;
+      break;
+    }
+    // otherwise the shallowest entry, counting older searches as shallower
+    uint8_t age = (_generation - _data_generation(data)) & GENERATION_MASK;
+    int score = data ? _unpack(data).depth - 8 * age : INT32_MIN;
+    if (score < replace_score) {
+      replace = &slot;
+      replace_score = score;
+    }
+  }
+  if (!same_position && replace_score != INT32_MIN) {
+    _collisions.fetch_add(1, std::memory_order_relaxed);
+  }
+  uint64_t data = _pack(entry, _generation);
+  replace->check.store(key ^ data, std::memory_order_relaxed);
+  replace->data.store(data, std::memory_order_relaxed);
+}
+
+size_t TranspositionTable::size_mb() const {
+  return (_num_buckets * sizeof(_Bucket)) >> 20;
+}
+
+unsigned TranspositionTable::hashfull() const {
+  unsigned used = 0, sampled = 0;
+  for (size_t i = 0; i < _num_buckets && sampled < 1000; i++) {
+    for (const _Slot &slot : _buckets[i].slots) {
+      uint64_t data = slot.data.load(std::memory_order_relaxed);
+      used += data && _data_generation(data) == _generation;
+      sampled++;
+    }
+  }
+  return used * 1000 / sampled;
+}
@@ -0,0 +1,59 @@
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#pragma once
+
+namespace ai {
+
+// a stored search result for a position
+struct TTEntry {
+  int32_t rating;
+  // the best move found, as `from | to << 6 | promotion << 12`, or 0
+  uint16_t move;
+  uint8_t depth;
+  enum Flag : uint8_t { NONE, EXACT, LOWERBOUND, UPPERBOUND } flag;
+};
+
+// a fixed-size hash table of search results shared by every search thread;
+// entries are stored without locks as two words, the key xor'd with the data,
+// so a torn write is detected as a miss on the next probe
+class TranspositionTable {
+public:
+  TranspositionTable(size_t mb);
+  ~TranspositionTable();
+  // reallocate the table to the largest power of two that fits in `mb`
+  // megabytes, clearing it
+  void resize(size_t mb);
+  // remove all entries and reset the counters
+  void clear();
+  // age the existing entries so they are replaced before new ones
+  void new_search();
+  // find a position, returning true and filling `entry` if it's stored
+  bool probe(uint64_t key, TTEntry &entry);
+  // store a position, keeping the deeper of two results for the same position
+  // and otherwise replacing the shallowest or oldest entry in its bucket
+  void store(uint64_t key, TTEntry entry);
+  size_t size_mb() const;
+  // the permille of slots used by the current search
+  unsigned hashfull() const;
+  // lookups that found, or did not find, their position, and stores that
+  // replaced a different position
+  uint64_t hits() const { return _hits; }
+  uint64_t misses() const { return _misses; }
+  uint64_t collisions() const { return _collisions; }
+
+private:
+  struct _Slot {
+    std::atomic<uint64_t> check, data;
+  };
+  static const unsigned _SLOTS_PER_BUCKET = 4;
+  struct alignas(64) _Bucket {
+    _Slot slots[_SLOTS_PER_BUCKET];
+  };
+  _Bucket *_buckets = nullptr;
+  size_t _num_buckets = 0;
+  uint8_t _generation = 0;
+  std::atomic<uint64_t> _hits{0}, _misses{0}, _collisions{0};
+};
+
+} // namespace ai
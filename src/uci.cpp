@@ -0,0 +1,272 @@
+#include "uci.hpp"
+#include "ai.hpp"
+#include "book.hpp"
+#include "stats.hpp"
+#include "syzygy.hpp"
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+
+using namespace chess;
+using namespace ai;
+
+// milliseconds kept back from every move for the time the GUI takes to pass
+// the move on
+#define MOVE_OVERHEAD 50
+// moves the remaining time is shared between when the GUI doesn't say
+#define DEFAULT_MOVES_TO_GO 30
+
+// the position searches start from
+Game _game;
+
+// the background search, which `stop` ends early; infinite and pondering
+// searches hold their reply until they are stopped or the ponder is hit
+std::thread _searcher;
+std::atomic<bool> _stop_search, _pondering;
+bool _infinite;
+std::mutex _mutex;
+std::condition_variable _wake;
+
+// report an iteration of the search
+void _info(const MoveChoice &choice) {
+  printf("info depth %u score ", choice.depth);
+  if (int moves = mate_moves(choice.target_rating)) {
+    printf("mate %d", moves);
+  } else {
+    printf("cp %d", choice.target_rating);
+  }
+  printf(" nodes %llu nps %llu time %u hashfull %u tbhits %llu pv ",
+         (unsigned long long)choice.nodes,
+         (unsigned long long)(choice.nodes * 1000 /
+                              std::max(choice.elapsed, 1u)),
+         choice.elapsed, trans_table.hashfull(),
+         (unsigned long long)choice.tb_hits);
+  print_line(choice.pv);
+  printf("\n");
+  trace_iteration(choice);
+}
+
+// end the background search, if any, waiting for it to reply
+void _finish_search() {
+  if (!_searcher.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop_search = true;
+  }
+  _wake.notify_all();
+  _searcher.join();
+}
+
+// set up the position from the start position or a FEN, followed by moves
+void _position(std::istringstream &args) {
+  std::string token;
+  args >> token;
+  _game = Game();
+  if (token == "fen") {
+    std::string fen;
+    while (args >> token && token != "moves") {
+      fen += token + " ";
+    }
+    if (!_game.load_fen(fen.c_str())) {
+      printf("info string invalid fen %s\n", fen.c_str());
+      return;
+    }
+  } else if (token == "startpos") {
+    args >> token;
+  }
+  if (token != "moves") {
+    return;
+  }
+  while (args >> token) {
+    Player *player = _game.turn == WHITE ? &_game.white : &_game.black;
+    Move move;
+    if (!_game.parse_move(player, token.c_str(), move)) {
+      printf("info string illegal move %s\n", token.c_str());
+      return;
+    }
+    _game.make_move(move);
+  }
+}
+
+// start searching the current position in the background
+void _go(std::istringstream &args) {
+  _finish_search();
+  Limits limits;
+  long time = 0, inc = 0, moves_to_go = 0;
+  bool infinite = false, ponder = false;
+  std::string token;
+  while (args >> token) {
+    if (token == "wtime" || token == "btime") {
+      long value;
+      args >> value;
+      if ((token == "wtime") == (_game.turn == WHITE)) {
+        time = value;
+      }
+    } else if (token == "winc" || token == "binc") {
+      long value;
+      args >> value;
+      if ((token == "winc") == (_game.turn == WHITE)) {
+        inc = value;
+      }
+    } else if (token == "movestogo") {
+      args >> moves_to_go;
+    } else if (token == "movetime") {
+      args >> limits.movetime;
+    } else if (token == "depth") {
+      args >> limits.depth;
+    } else if (token == "nodes") {
+      args >> limits.nodes;
+    } else if (token == "infinite") {
+      infinite = true;
+    } else if (token == "ponder") {
+      ponder = true;
+    }
+  }
+  // spend a share of the remaining time, plus most of the increment, on this
+  // move
+  if (time && !limits.movetime) {
+    long share = time / (moves_to_go ? moves_to_go : DEFAULT_MOVES_TO_GO) +
+                 inc * 3 / 4;
+    limits.movetime = std::max(1l, std::min(share, time - MOVE_OVERHEAD));
+  }
+  // search as deep as it can unless told otherwise, rather than picking a
+  // depth from the pieces left
+  limits.depth = std::min(limits.depth ? limits.depth : MAX_PLY - 1,
+                          (unsigned)MAX_PLY - 1);
+  _stop_search = false;
+  _pondering = ponder;
+  _infinite = infinite;
+  limits.stop = &_stop_search;
+  limits.ponder = &_pondering;
+
+  // book moves are played at once, unless the GUI wants to watch a search
+  Move book_move;
+  book_move.data = 0;
+  if (!infinite && !ponder) {
+    book::probe(_game, book_move);
+  }
+
+  _searcher = std::thread([limits, book_move, game = _game]() mutable {
+    Player *player = game.turn == WHITE ? &game.white : &game.black;
+    Move move = book_move, reply;
+    reply.data = 0;
+    if (!move.data && game.get_state(player) == Game::IN_PLAY) {
+      MoveChoice choice = best_move(game, player, limits);
+      trace_search(game.get_fen().c_str(), choice);
+      move = choice.move;
+      if (choice.pv.length > 1) {
+        reply = choice.pv.moves[1];
+      }
+    }
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _wake.wait(lock,
+                 [] { return _stop_search || (!_infinite && !_pondering); });
+    }
+    char text[6] = "0000";
+    if (move.data) {
+      move.to_text(text);
+    }
+    printf("bestmove %s", text);
+    if (reply.data) {
+      reply.to_text(text);
+      printf(" ponder %s", text);
+    }
+    printf("\n");
+  });
+}
+
+// change one of the options listed in reply to `uci`
+void _set_option(std::istringstream &args) {
+  std::string token, name, value;
+  args >> token;
+  while (args >> token && token != "value") {
+    name += name.empty() ? token : " " + token;
+  }
+  // the value is the rest of the line, since a path can have spaces
+  std::getline(args >> std::ws, value);
+  if (!strcasecmp(name.c_str(), "Hash")) {
+    trans_table.resize(std::max(atoi(value.c_str()), 1));
+  } else if (!strcasecmp(name.c_str(), "Threads")) {
+    num_threads = std::max(atoi(value.c_str()), 1);
+  } else if (!strcasecmp(name.c_str(), "BookFile")) {
+    if (value == "<empty>") {
+      book::close();
+    } else if (!book::open(value.c_str())) {
+      printf("info string could not open book %s\n", value.c_str());
+    }
+  } else if (!strcasecmp(name.c_str(), "TraceFile")) {
+    if (value == "<empty>") {
+      close_trace();
+    } else if (!open_trace(value.c_str())) {
+      printf("info string could not open trace %s\n", value.c_str());
+    }
+  } else if (!strcasecmp(name.c_str(), "SyzygyPath")) {
+    unsigned found = syzygy::init(value == "<empty>" ? "" : value);
+    printf("info string found %u tablebases\n", found);
+  } else if (!strcasecmp(name.c_str(), "SyzygyProbeLimit")) {
+    tb_probe_limit = atoi(value.c_str());
+  }
+}
+
+void uci::loop(bool initialized) {
+  setvbuf(stdout, nullptr, _IOLBF, 0);
+  verbose = false;
+  on_iteration = _info;
+  std::string line = initialized ? "uci" : "";
+  if (!initialized && !std::getline(std::cin, line)) {
+    return;
+  }
+  do {
+    std::istringstream args(line);
+    std::string command;
+    args >> command;
+    if (command == "uci") {
+      printf("id name milkchess\n");
+      printf("id author the milkchess authors\n");
+      printf("option name Hash type spin default %zu min 1 max 65536\n",
+             trans_table.size_mb());
+      printf("option name Threads type spin default %u min 1 max 256\n",
+             num_threads);
+      printf("option name Ponder type check default false\n");
+      printf("option name BookFile type string default <empty>\n");
+      printf("option name TraceFile type string default <empty>\n");
+      printf("option name SyzygyPath type string default <empty>\n");
+      printf("option name SyzygyProbeLimit type spin default %u min 0 max 7\n",
+             tb_probe_limit);
+      printf("uciok\n");
+    } else if (command == "isready") {
+      printf("readyok\n");
+    } else if (command == "setoption") {
+      _finish_search();
+      _set_option(args);
+    } else if (command == "ucinewgame") {
+      _finish_search();
+      trans_table.clear();
+    } else if (command == "position") {
+      _finish_search();
+      _position(args);
+    } else if (command == "go") {
+      _go(args);
+    } else if (command == "stop") {
+      _finish_search();
+    } else if (command == "ponderhit") {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pondering = false;
+      }
+      _wake.notify_all();
+    } else if (command == "quit") {
+      break;
+    }
+  } while (std::getline(std::cin, line));
+  _finish_search();
+  close_trace();
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+namespace uci {
+
+// speak the universal chess interface on stdin and stdout until `quit`,
+// searching on a background thread so `stop` and `ponderhit` are handled
+// while it runs; `initialized` is set if the `uci` command was already read
+void loop(bool initialized = false);
+
+} // namespace uci